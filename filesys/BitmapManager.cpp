@@ -5,105 +5,584 @@
 #include "BitmapManager.h"
 #include "cassert"
 #include "cstdio"
+#include "algorithm"
+#ifdef NOT_KERNEL
+#include "unordered_map"
+#endif
+#if defined(__AVX2__)
+#include "immintrin.h"
+#elif defined(__ARM_NEON)
+#include "arm_neon.h"
+#endif
 
 namespace fs {
 
+#ifdef NOT_KERNEL
+static std::atomic<uint64_t> nextInstanceId{0};
+#endif
+
+// Index of the first word in [0, count) with a clear bit, or count if every word is full.
+static size_t firstNonFullWord(const uint64_t* words, const size_t count)
+{
+    size_t w = 0;
+#if defined(__AVX2__)
+    const __m256i full = _mm256_set1_epi64x(-1);
+    for (; w + 4 <= count; w += 4)
+    {
+        const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + w));
+        const int fullMask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(chunk, full)));
+        if (fullMask != 0xF)
+        {
+            return w + __builtin_ctz(~fullMask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; w + 2 <= count; w += 2)
+    {
+        // AND of the two words is all ones only if both are full.
+        const uint64x2_t chunk = vld1q_u64(words + w);
+        if ((vgetq_lane_u64(chunk, 0) & vgetq_lane_u64(chunk, 1)) != UINT64_MAX)
+        {
+            return vgetq_lane_u64(chunk, 0) != UINT64_MAX ? w : w + 1;
+        }
+    }
+#endif
+    for (; w < count; w++)
+    {
+        if (words[w] != UINT64_MAX)
+        {
+            return w;
+        }
+    }
+    return count;
+}
+
 BitmapManager::BitmapManager(const block_index_t startBlock, const block_index_t numBlocks, const block_index_t size,
-                             BlockManager* blockManager, block_index_t offset): startBlock(startBlock),
+                             BlockManager* blockManager, block_index_t offset, const block_index_t blockStride,
+                             const block_index_t bitsPerBlock): startBlock(startBlock),
     numBlocks(numBlocks), size(size),
-    blockManager(blockManager), additionalOffset(offset)
+    blockManager(blockManager), blockStride(blockStride), bitsPerBlock(bitsPerBlock),
+    additionalOffset(offset)
+#ifdef NOT_KERNEL
+    , instanceId(nextInstanceId++)
+#endif
 {
 //    cout << "loading bitmap with start block: " << startBlock << " num blocks: " << numBlocks << " size: " << size << endl;
-    loadBitmap(0);
+    loadBitmap();
 }
 
-void BitmapManager::loadBitmap(const block_index_t offset)
+void BitmapManager::loadBitmap()
 {
-    if (offset >= numBlocks)
+    words.assign(static_cast<size_t>(numBlocks) * NUM_PARTS, 0);
+    if (blockStride == 1)
     {
-        printf("Offset out of bounds\n");
-        assert(0);
+        if (!blockManager->readBlocks(startBlock, numBlocks, reinterpret_cast<uint8_t*>(words.data())))
+        {
+            printf("Could not read bitmap blocks\n");
+            assert(0);
+        }
     }
-    if (dirty)
+    else
     {
-        saveBitmap();
+        for (block_index_t b = 0; b < numBlocks; b++)
+        {
+            if (!blockManager->readBlock(startBlock + b * blockStride, reinterpret_cast<uint8_t*>(&words[b * NUM_PARTS])))
+            {
+                printf("Could not read bitmap block\n");
+                assert(0);
+            }
+        }
     }
-    if (!blockManager->readBlock(startBlock + offset, loadedBlock.data))
+    // Likewise for the unused tail of each bitmap block when only part of it is in use.
+    if (bitsPerBlock < BITS_PER_BLOCK)
     {
-        printf("Could not read bitmap block\n");
-        assert(0);
+        for (block_index_t b = 0; b < numBlocks; b++)
+        {
+            uint64_t* blockWords = &words[b * NUM_PARTS];
+            if (bitsPerBlock % 64 != 0)
+            {
+                blockWords[bitsPerBlock / 64] |= ~0ULL << (bitsPerBlock % 64);
+            }
+            for (block_index_t w = (bitsPerBlock + 63) / 64; w < NUM_PARTS; w++)
+            {
+                blockWords[w] = UINT64_MAX;
+            }
+        }
     }
-    dirty = false;
-    loadedBlockIndex = offset;
+    // Bits past the end of the bitmap do not correspond to anything; keep them set so they are never handed out.
+    if (size % 64 != 0)
+    {
+        words[size / 64] |= ~0ULL << (size % 64);
+    }
+    for (size_t w = (size + 63) / 64; w < words.size(); w++)
+    {
+        words[w] = UINT64_MAX;
+    }
+    blockDirty.assign(numBlocks, 0);
+    rebuildSummaries();
 }
 
-bool BitmapManager::saveBitmap()
+void BitmapManager::rebuildSummaries()
 {
-    if (loadedBlockIndex == NULL_INDEX)
+    groupFree.assign(static_cast<size_t>(numBlocks) * GROUPS_PER_BLOCK, 0);
+    blockFree.assign(numBlocks, 0);
+    freeCount = 0;
+    // Counted one group at a time so the compiler can vectorise the inner popcount loop.
+    for (size_t g = 0; g < groupFree.size(); g++)
     {
-        printf("Attempted to save invalid block index\n");
-        return false;
+        const uint64_t* groupWords = &words[g * WORDS_PER_GROUP];
+        uint32_t setBits = 0;
+        for (block_index_t w = 0; w < WORDS_PER_GROUP; w++)
+        {
+            setBits += __builtin_popcountll(groupWords[w]);
+        }
+        groupFree[g] = static_cast<uint16_t>(BITS_PER_GROUP - setBits);
+        blockFree[g / GROUPS_PER_BLOCK] += groupFree[g];
+        freeCount += groupFree[g];
     }
+}
 
-    if (!blockManager->writeBlock(startBlock + loadedBlockIndex, loadedBlock.data))
+block_index_t BitmapManager::getFreeCount() const
+{
+    block_index_t free = __atomic_load_n(&freeCount, __ATOMIC_RELAXED);
+#ifdef NOT_KERNEL
+    std::lock_guard<std::mutex> lock(magazineMutex);
+    for (const auto& mag : magazines)
     {
-        printf("Could not write bitmap block\n");
-        assert(0);
+        const uint64_t range = mag->range.load();
+        const auto next = static_cast<block_index_t>(range);
+        const auto end = static_cast<block_index_t>(range >> 32);
+        free += end > next ? end - next : 0;
+    }
+#endif
+    return free;
+}
+
+bool BitmapManager::flush()
+{
+#ifdef NOT_KERNEL
+    std::vector<uint64_t> image;
+#endif
+    block_index_t b = 0;
+    while (b < numBlocks)
+    {
+        if (!__atomic_load_n(&blockDirty[b], __ATOMIC_ACQUIRE))
+        {
+            b++;
+            continue;
+        }
+        // Adjacent dirty blocks go out in one write (only possible when the bitmap blocks are contiguous on disk).
+        block_index_t run = 1;
+        while (blockStride == 1 && b + run < numBlocks && __atomic_load_n(&blockDirty[b + run], __ATOMIC_ACQUIRE))
+        {
+            run++;
+        }
+        // Cleared before writing, so a bit changed while the write is in progress marks the block dirty again.
+        for (block_index_t i = 0; i < run; i++)
+        {
+            __atomic_store_n(&blockDirty[b + i], 0, __ATOMIC_RELEASE);
+        }
+#ifdef NOT_KERNEL
+        // Read after the dirty flags are cleared: a reserved bit handed out later marks its block dirty again.
+        const uint8_t* data = diskImage(b, run, image);
+#else
+        const auto* data = reinterpret_cast<const uint8_t*>(&words[b * NUM_PARTS]);
+#endif
+        if (!blockManager->writeBlocks(startBlock + b * blockStride, run, data))
+        {
+            printf("Could not write bitmap block\n");
+            for (block_index_t i = 0; i < run; i++)
+            {
+                __atomic_store_n(&blockDirty[b + i], 1, __ATOMIC_RELEASE);
+            }
+            return false;
+        }
+        b += run;
     }
-    dirty = false;
     return true;
 }
 
-block_index_t BitmapManager::findNextFree()
+block_index_t BitmapManager::findInBlock(const block_index_t b, const block_index_t firstGroup)
 {
-    if (loadedBlockIndex == NULL_INDEX)
+    if (blockFree[b] == 0)
     {
-        loadBitmap(0);
+        return NULL_INDEX;
     }
-    block_index_t curIteration = 0;
-    while (curIteration < numBlocks)
+    for (block_index_t g = b * GROUPS_PER_BLOCK + firstGroup; g < (b + 1) * GROUPS_PER_BLOCK; g++)
     {
-        for (size_t i = 0; i < NUM_PARTS; i++)
+        if (groupFree[g] == 0)
         {
-            if (loadedBlock.bitmapBlock.parts[i] != UINT64_MAX)
+            continue;
+        }
+        // groupFree guarantees a clear bit somewhere in this group.
+        const block_index_t w = g * WORDS_PER_GROUP + firstNonFullWord(&words[g * WORDS_PER_GROUP], WORDS_PER_GROUP);
+        __atomic_store_n(&searchBlock, b, __ATOMIC_RELAXED);
+        return w * 64 + __builtin_ctzll(~words[w]);
+    }
+    return NULL_INDEX;
+}
+
+block_index_t BitmapManager::findNextFree(const block_index_t goal)
+{
+    block_index_t firstBlock = __atomic_load_n(&searchBlock, __ATOMIC_RELAXED);
+    if (goal != NULL_INDEX && goal >= additionalOffset && goal - additionalOffset < size)
+    {
+        // Try the goal itself and whatever follows it in its group and bitmap block before moving on.
+        const block_index_t goalBit = goal - additionalOffset;
+        const block_index_t group = goalBit / BITS_PER_GROUP;
+        block_index_t w = goalBit / 64;
+        const uint64_t word = words[w] | ((1ULL << (goalBit % 64)) - 1);
+        if (word != UINT64_MAX)
+        {
+            return additionalOffset + w * 64 + __builtin_ctzll(~word);
+        }
+        const block_index_t groupEnd = (group + 1) * WORDS_PER_GROUP;
+        if (++w < groupEnd && groupFree[group] != 0)
+        {
+            w += firstNonFullWord(&words[w], groupEnd - w);
+            if (w < groupEnd)
+            {
+                return additionalOffset + w * 64 + __builtin_ctzll(~words[w]);
+            }
+        }
+        const block_index_t goalBlock = goalBit / BITS_PER_BLOCK;
+        const block_index_t bit = findInBlock(goalBlock, group % GROUPS_PER_BLOCK + 1);
+        if (bit != NULL_INDEX)
+        {
+            return additionalOffset + bit;
+        }
+        // The remaining blocks, ending with the start of the goal's own block.
+        firstBlock = goalBlock + 1;
+    }
+    for (block_index_t iteration = 0; iteration < numBlocks; iteration++)
+    {
+        const block_index_t bit = findInBlock((firstBlock + iteration) % numBlocks, 0);
+        if (bit != NULL_INDEX)
+        {
+            return additionalOffset + bit;
+        }
+    }
+    return NULL_INDEX;
+}
+
+block_index_t BitmapManager::findFreeRange(const block_index_t count, const block_index_t minCount,
+                                           block_index_t& foundCount, const block_index_t goal)
+{
+    foundCount = 0;
+    if (count == 0)
+    {
+        return NULL_INDEX;
+    }
+    block_index_t runStart = 0;
+    block_index_t runLength = 0;
+    block_index_t bestStart = NULL_INDEX;
+    block_index_t bestLength = 0;
+    size_t startBit = static_cast<size_t>(__atomic_load_n(&searchBlock, __ATOMIC_RELAXED)) * BITS_PER_BLOCK;
+    if (goal != NULL_INDEX && goal >= additionalOffset && goal - additionalOffset < size)
+    {
+        startBit = goal - additionalOffset;
+    }
+    const size_t startWord = startBit / 64;
+    // One extra iteration revisits the first word so the bits before startBit are considered last.
+    for (size_t i = 0; i <= words.size(); i++)
+    {
+        const size_t w = (startWord + i) % words.size();
+        if (w == 0)
+        {
+            // Runs do not wrap around the end of the bitmap.
+            runLength = 0;
+        }
+        if (w % NUM_PARTS == 0 && blockFree[w / NUM_PARTS] == 0)
+        {
+            runLength = 0;
+            i += NUM_PARTS - 1;
+            continue;
+        }
+        uint64_t word = words[w];
+        if (i == 0)
+        {
+            word |= (1ULL << (startBit % 64)) - 1;
+        }
+        if (word == UINT64_MAX)
+        {
+            runLength = 0;
+            continue;
+        }
+        if (word == 0)
+        {
+            if (runLength == 0)
             {
-                for (uint8_t j = 0; j < 64; j++)
+                runStart = w * 64;
+            }
+            runLength += 64;
+        }
+        else
+        {
+            for (uint8_t j = 0; j < 64 && runLength < count; j++)
+            {
+                if (word & 1ULL << j)
+                {
+                    runLength = 0;
+                }
+                else if (runLength++ == 0)
                 {
-                    if (!(loadedBlock.bitmapBlock.parts[i] & 1ULL << j))
-                    {
-                        return additionalOffset + (loadedBlockIndex * BlockManager::BLOCK_SIZE * 8 +
-                            i * sizeof(uint64_t) * 8 + j);
-                    }
+                    runStart = w * 64 + j;
                 }
+                if (runLength > bestLength)
+                {
+                    bestStart = runStart;
+                    bestLength = runLength;
+                }
+            }
+        }
+        if (runLength > bestLength)
+        {
+            bestStart = runStart;
+            bestLength = runLength;
+        }
+        if (bestLength >= count)
+        {
+            break;
+        }
+    }
+    if (bestLength < std::max<block_index_t>(minCount, 1))
+    {
+        return NULL_INDEX;
+    }
+    foundCount = std::min(bestLength, count);
+    __atomic_store_n(&searchBlock, (bestStart + foundCount - 1) / BITS_PER_BLOCK, __ATOMIC_RELAXED);
+    return additionalOffset + bestStart;
+}
+
+bool BitmapManager::updateBit(const block_index_t bit, const bool allocated, const bool markBlockDirty)
+{
+    uint64_t* word = &words[bit / 64];
+    const uint64_t mask = 1ULL << (bit % 64);
+    const uint64_t old = allocated ? __atomic_fetch_or(word, mask, __ATOMIC_ACQ_REL)
+                                   : __atomic_fetch_and(word, ~mask, __ATOMIC_ACQ_REL);
+    if (static_cast<bool>(old & mask) == allocated)
+    {
+        return false;
+    }
+    if (allocated)
+    {
+        __atomic_fetch_sub(&groupFree[bit / BITS_PER_GROUP], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&blockFree[bit / BITS_PER_BLOCK], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&freeCount, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_add(&groupFree[bit / BITS_PER_GROUP], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&blockFree[bit / BITS_PER_BLOCK], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&freeCount, 1, __ATOMIC_RELAXED);
+    }
+    if (markBlockDirty)
+    {
+        markDirty(bit);
+    }
+    return true;
+}
+
+void BitmapManager::markDirty(const block_index_t bit)
+{
+    __atomic_store_n(&blockDirty[bit / BITS_PER_BLOCK], 1, __ATOMIC_RELEASE);
+}
+
+block_index_t BitmapManager::allocateRange(const block_index_t count, const block_index_t minCount,
+                                           block_index_t& foundCount, const block_index_t goal)
+{
+    while (true)
+    {
+        block_index_t found;
+        const block_index_t start = findFreeRange(count, minCount, found, goal);
+        if (start == NULL_INDEX)
+        {
+            foundCount = 0;
+            return NULL_INDEX;
+        }
+        const block_index_t bit = start - additionalOffset;
+        block_index_t claimed = 0;
+        while (claimed < found && updateBit(bit + claimed, true))
+        {
+            claimed++;
+        }
+        if (claimed >= std::max<block_index_t>(minCount, 1))
+        {
+            foundCount = claimed;
+            return start;
+        }
+        // Lost the run to another thread; give back what was claimed and look again.
+        for (block_index_t i = 0; i < claimed; i++)
+        {
+            updateBit(bit + i, false);
+        }
+    }
+}
+
+block_index_t BitmapManager::findFreeAligned(const block_index_t count, const block_index_t goal)
+{
+    assert(count > 0 && count <= 64 && 64 % count == 0);
+    const uint64_t mask = count == 64 ? UINT64_MAX : (1ULL << count) - 1;
+    size_t startWord = static_cast<size_t>(__atomic_load_n(&searchBlock, __ATOMIC_RELAXED)) * NUM_PARTS;
+    if (goal != NULL_INDEX && goal >= additionalOffset && goal - additionalOffset < size)
+    {
+        startWord = (goal - additionalOffset) / 64;
+    }
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        const size_t w = (startWord + i) % words.size();
+        // Skip whole bitmap blocks that cannot hold the run.
+        if (w % NUM_PARTS == 0 && i != 0 && __atomic_load_n(&blockFree[w / NUM_PARTS], __ATOMIC_RELAXED) < count)
+        {
+            i += NUM_PARTS - 1;
+            continue;
+        }
+        const uint64_t word = __atomic_load_n(&words[w], __ATOMIC_RELAXED);
+        for (block_index_t shift = 0; shift < 64 && word != UINT64_MAX; shift += count)
+        {
+            if ((word >> shift & mask) == 0)
+            {
+                return additionalOffset + static_cast<block_index_t>(w * 64 + shift);
             }
         }
-        loadBitmap((loadedBlockIndex + 1) % numBlocks);
-        curIteration++;
     }
     return NULL_INDEX;
 }
 
-bool BitmapManager::setAllocated(block_index_t index)
+bool BitmapManager::tryAllocate(const block_index_t index)
 {
-    index -= additionalOffset;
-    if (index >= size)
+    if (index < additionalOffset || index - additionalOffset >= size)
     {
         printf("Index out of bounds for bitmap\n");
         return false;
-        // assert(0);
     }
+    return updateBit(index - additionalOffset, true);
+}
 
-    const block_index_t targetOffset = index / 8 / BlockManager::BLOCK_SIZE;
-    const block_index_t targetPart = (index % (8 * BlockManager::BLOCK_SIZE)) / (sizeof(uint64_t) * 8);
-    const uint8_t targetJ = index % (sizeof(uint64_t) * 8);
+#ifdef NOT_KERNEL
+BitmapManager::magazine* BitmapManager::threadMagazine()
+{
+    thread_local std::unordered_map<uint64_t, magazine*> threadMagazines;
+    const auto it = threadMagazines.find(instanceId);
+    if (it != threadMagazines.end())
+    {
+        return it->second;
+    }
+    std::lock_guard<std::mutex> lock(magazineMutex);
+    magazines.push_back(std::make_unique<magazine>());
+    threadMagazines[instanceId] = magazines.back().get();
+    return magazines.back().get();
+}
 
-    if (loadedBlockIndex != targetOffset)
+void BitmapManager::releaseRange(const uint64_t range)
+{
+    for (auto bit = static_cast<block_index_t>(range); bit < static_cast<block_index_t>(range >> 32); bit++)
     {
-        loadBitmap(targetOffset);
+        updateBit(bit, false, false);
     }
+}
 
-    loadedBlock.bitmapBlock.parts[targetPart] |= 1ULL << targetJ;
-    dirty = true;
+void BitmapManager::releaseReservations()
+{
+    std::lock_guard<std::mutex> lock(magazineMutex);
+    for (const auto& mag : magazines)
+    {
+        releaseRange(mag->range.exchange(0));
+    }
+}
+
+const uint8_t* BitmapManager::diskImage(const block_index_t first, const block_index_t count,
+                                        std::vector<uint64_t>& image) const
+{
+    const size_t firstWord = static_cast<size_t>(first) * NUM_PARTS;
+    const size_t endWord = firstWord + static_cast<size_t>(count) * NUM_PARTS;
+    bool copied = false;
+    std::lock_guard<std::mutex> lock(magazineMutex);
+    for (const auto& mag : magazines)
+    {
+        const uint64_t range = mag->range.load();
+        for (auto bit = static_cast<block_index_t>(range); bit < static_cast<block_index_t>(range >> 32); bit++)
+        {
+            if (bit / 64 < firstWord || bit / 64 >= endWord)
+            {
+                continue;
+            }
+            if (!copied)
+            {
+                image.resize(endWord - firstWord);
+                for (size_t w = firstWord; w < endWord; w++)
+                {
+                    image[w - firstWord] = __atomic_load_n(&words[w], __ATOMIC_RELAXED);
+                }
+                copied = true;
+            }
+            image[bit / 64 - firstWord] &= ~(1ULL << (bit % 64));
+        }
+    }
+    return reinterpret_cast<const uint8_t*>(copied ? image.data() : &words[firstWord]);
+}
+#else
+void BitmapManager::releaseReservations()
+{
+    // Without magazines nothing is reserved.
+}
+#endif
+
+block_index_t BitmapManager::allocate(const block_index_t goal)
+{
+#ifdef NOT_KERNEL
+    magazine* mag = threadMagazine();
+    const bool hasGoal = goal != NULL_INDEX && goal >= additionalOffset && goal - additionalOffset < size;
+    if (hasGoal && (goal - additionalOffset) / BITS_PER_GROUP != mag->goalGroup)
+    {
+        releaseRange(mag->range.exchange(0));
+    }
+    uint64_t range = mag->range.load();
+    while (static_cast<block_index_t>(range) < static_cast<block_index_t>(range >> 32))
+    {
+        if (mag->range.compare_exchange_weak(range, range + 1))
+        {
+            // The bit has been set since it was reserved; make sure the next flush writes it out as allocated.
+            markDirty(static_cast<block_index_t>(range));
+            return additionalOffset + static_cast<block_index_t>(range);
+        }
+    }
+    // Empty: reserve the next batch near the goal, hand out its first bit and keep the rest.
+    block_index_t reserved;
+    const block_index_t start = allocateRange(MAGAZINE_SIZE, 1, reserved, goal);
+    if (start == NULL_INDEX)
+    {
+        return NULL_INDEX;
+    }
+    const block_index_t bit = start - additionalOffset;
+    mag->goalGroup = (hasGoal ? goal - additionalOffset : bit) / BITS_PER_GROUP;
+    mag->range.store((bit + 1) | static_cast<uint64_t>(bit + reserved) << 32);
+    // A flush between claiming the batch and storing it may have written the reserved bits as allocated.
+    markDirty(bit);
+    markDirty(bit + reserved - 1);
+    return start;
+#else
+    while (true)
+    {
+        const block_index_t index = findNextFree(goal);
+        if (index == NULL_INDEX || updateBit(index - additionalOffset, true))
+        {
+            return index;
+        }
+    }
+#endif
+}
+
+bool BitmapManager::setAllocated(block_index_t index)
+{
+    index -= additionalOffset;
+    if (index >= size)
+    {
+        printf("Index out of bounds for bitmap\n");
+        return false;
+        // assert(0);
+    }
+    updateBit(index, true);
     return true;
 }
 
@@ -116,18 +595,37 @@ bool BitmapManager::setUnallocated(block_index_t index)
         return false;
         // assert(0);
     }
+    updateBit(index, false);
+    return true;
+}
 
-    const block_index_t targetOffset = index / 8 / BlockManager::BLOCK_SIZE;
-    const block_index_t targetPart = (index % (8 * BlockManager::BLOCK_SIZE)) / (sizeof(uint64_t) * 8);
-    const uint8_t targetJ = index % (sizeof(uint64_t) * 8);
-
-    if (loadedBlockIndex != targetOffset)
+bool BitmapManager::setAllocatedRange(block_index_t index, const block_index_t count)
+{
+    index -= additionalOffset;
+    if (index >= size || count > size - index)
+    {
+        printf("Range out of bounds for bitmap\n");
+        return false;
+    }
+    for (block_index_t i = 0; i < count; i++)
     {
-        loadBitmap(targetOffset);
+        updateBit(index + i, true);
     }
+    return true;
+}
 
-    loadedBlock.bitmapBlock.parts[targetPart] &= ~(1ULL << targetJ);
-    dirty = true;
+bool BitmapManager::setUnallocatedRange(block_index_t index, const block_index_t count)
+{
+    index -= additionalOffset;
+    if (index >= size || count > size - index)
+    {
+        printf("Range out of bounds for bitmap\n");
+        return false;
+    }
+    for (block_index_t i = 0; i < count; i++)
+    {
+        updateBit(index + i, false);
+    }
     return true;
 }
 
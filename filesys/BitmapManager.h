@@ -6,36 +6,126 @@
 #define BITMAPMANAGER_H
 #include "Block.h"
 #include "../interface/BlockManager.h"
+#include "vector"
+#ifdef NOT_KERNEL
+#include "atomic"
+#include "memory"
+#include "mutex"
+#endif
 
 #define NULL_INDEX UINT32_MAX
 
 namespace fs {
 
+// The whole bitmap is kept in memory, together with two summary levels (free bits per group of 64 words and
+// free bits per bitmap block) so that a search skips full regions without touching their words. Changes only
+// mark their bitmap block dirty; the LogManager writes the dirty blocks back with flush() before each log entry
+// that could refer to them reaches the disk.
+//
+// Bits are claimed and released with atomic read-modify-write operations on the bitmap words, so concurrent
+// allocate() calls never hand out the same bit; the summaries are hints that are updated atomically as well.
 class BitmapManager
 {
 public:
-    BitmapManager(block_index_t startBlock, block_index_t numBlocks, block_index_t size, BlockManager* blockManager, block_index_t offset = 0);
-    block_index_t findNextFree();
+    static constexpr block_index_t BITS_PER_BLOCK = BlockManager::BLOCK_SIZE * 8;
+
+    // Bitmap block b is stored at startBlock + b * blockStride, so a bitmap can be spread over block groups. Only
+    // the first bitsPerBlock bits of each bitmap block are used; the rest of the block is never handed out.
+    BitmapManager(block_index_t startBlock, block_index_t numBlocks, block_index_t size, BlockManager* blockManager,
+                  block_index_t offset = 0, block_index_t blockStride = 1, block_index_t bitsPerBlock = BITS_PER_BLOCK);
+    // Searches forward from goal (wrapping around) so related allocations end up close together. Without a
+    // goal the search continues from where the previous one succeeded.
+    block_index_t findNextFree(block_index_t goal = NULL_INDEX);
+    // Finds a run of up to count contiguous free bits, searching forward from goal like findNextFree. The first
+    // run of count bits is returned; if there is none, the longest run found, as long as it has at least
+    // minCount bits. The run length is stored in foundCount. Returns NULL_INDEX if no run is long enough.
+    // Nothing is marked allocated.
+    block_index_t findFreeRange(block_index_t count, block_index_t minCount, block_index_t& foundCount,
+                                block_index_t goal = NULL_INDEX);
+    // Finds a free bit near goal and claims it, retrying if another thread claimed it first. Under NOT_KERNEL
+    // the bit comes from the calling thread's magazine, a small batch of bits reserved together, so concurrent
+    // allocators mostly work on their own reservations instead of contending for the same words. A goal outside
+    // the group of words the magazine was filled for gives the rest of the magazine back and refills it near goal.
+    block_index_t allocate(block_index_t goal = NULL_INDEX);
+    // findFreeRange followed by an atomic claim of the run. If another thread takes part of the run first, the
+    // bits claimed before the conflict are kept when there are at least minCount of them; otherwise it retries.
+    block_index_t allocateRange(block_index_t count, block_index_t minCount, block_index_t& foundCount,
+                                block_index_t goal = NULL_INDEX);
+    // Finds count free bits starting at a multiple of count (count must divide 64), searching forward from goal.
+    // Used to find a wholly free inode block. Nothing is marked allocated.
+    block_index_t findFreeAligned(block_index_t count, block_index_t goal = NULL_INDEX);
+    // Claims the bit at index if it is free. Returns false if it was already allocated.
+    bool tryAllocate(block_index_t index);
     bool setAllocated(block_index_t index);
     bool setUnallocated(block_index_t index);
+    bool setAllocatedRange(block_index_t index, block_index_t count);
+    bool setUnallocatedRange(block_index_t index, block_index_t count);
     block_index_t getStartBlock() const { return startBlock; }
+    // Free bits in the whole bitmap, counting bits reserved in magazines but not handed out yet as free.
+    block_index_t getFreeCount() const;
+    // Free bits in one bitmap block, kept current on every change; here reserved bits count as allocated.
+    block_index_t getFreeCount(block_index_t bitmapBlock) const { return blockFree[bitmapBlock]; }
+
+    // Writes every modified bitmap block back to disk, batching adjacent blocks into one write. Bits reserved in
+    // magazines stay reserved and are written as free, so a crash cannot leak them and a flush costs them nothing.
+    bool flush();
+    // Gives back the bits reserved in every thread's magazine, so threads that stopped allocating do not keep
+    // theirs out of reach indefinitely. The LogManager calls it at each checkpoint.
+    void releaseReservations();
 
 private:
     static constexpr block_index_t NUM_PARTS = BlockManager::BLOCK_SIZE / sizeof(uint64_t);
-    void loadBitmap(block_index_t offset);
-    bool saveBitmap();
+    static constexpr block_index_t WORDS_PER_GROUP = 64;
+    static constexpr block_index_t GROUPS_PER_BLOCK = NUM_PARTS / WORDS_PER_GROUP;
+    static constexpr block_index_t BITS_PER_GROUP = WORDS_PER_GROUP * 64;
+
+    void loadBitmap();
+    // First clear bit of bitmap block b, starting at group firstGroup within it. NULL_INDEX if there is none.
+    block_index_t findInBlock(block_index_t b, block_index_t firstGroup);
+    void rebuildSummaries();
+    // Flips the bit and keeps the summaries and dirty state in step. Returns false if the bit already had that value.
+    // Releasing a reserved bit need not dirty its block, since the disk never saw it allocated.
+    bool updateBit(block_index_t bit, bool allocated, bool markBlockDirty = true);
+    void markDirty(block_index_t bit);
 
     block_index_t startBlock;
     block_index_t numBlocks;
     block_index_t size;
     BlockManager* blockManager;
+    block_index_t blockStride;
+    block_index_t bitsPerBlock;
 
-    block_t loadedBlock{};
-    block_index_t loadedBlockIndex = NULL_INDEX;
-    bool dirty = false;
-    bool transparentOffset;
+    std::vector<uint64_t> words;        // numBlocks * NUM_PARTS words, each block laid out exactly as on disk
+    std::vector<uint16_t> groupFree;    // free bits in each group of WORDS_PER_GROUP words
+    std::vector<uint32_t> blockFree;    // free bits in each bitmap block
+    std::vector<uint8_t> blockDirty;    // bitmap blocks modified since the last flush
+    block_index_t freeCount = 0;        // free bits in the whole bitmap
+    block_index_t searchBlock = 0;      // bitmap block the next search starts from
     block_index_t additionalOffset;
+
+#ifdef NOT_KERNEL
+    static constexpr block_index_t MAGAZINE_SIZE = 8;
+
+    // Reserved bits [next, end), packed as next | end << 32 so the owner can take one and flush() can read the
+    // magazine (and releaseReservations() empty it) with single atomic operations.
+    struct magazine
+    {
+        std::atomic<uint64_t> range{0};
+        block_index_t goalGroup = NULL_INDEX;  // group of words the magazine was filled for; used by the owner only
+    };
+
+    magazine* threadMagazine();
+    // Gives back the reserved bits of a range taken out of a magazine.
+    void releaseRange(uint64_t range);
+    // The bitmap blocks [first, first + count) as they go to disk: the in-memory words, or a copy of them in
+    // image with the bits still reserved in magazines cleared.
+    const uint8_t* diskImage(block_index_t first, block_index_t count, std::vector<uint64_t>& image) const;
+
+    const uint64_t instanceId;          // key of this bitmap in each thread's magazine map
+    mutable std::mutex magazineMutex;   // guards magazines (registration, reading and emptying them)
+    std::vector<std::unique_ptr<magazine>> magazines;
+#endif
 };
 
 } // namespace fs
-#endif //BITMAPMANAGER_H
\ No newline at end of file
+#endif //BITMAPMANAGER_H
@@ -52,6 +52,10 @@ typedef struct directBlock
 } indirectBlock_t;
 
 
+// The superblock keeps the latest NUM_CHECKPOINTS checkpoints; checkpoint n is at checkpointArr[n % NUM_CHECKPOINTS]
+// and ID 0 stands for the live filesystem.
+constexpr uint32_t NUM_CHECKPOINTS = 128;
+
 typedef struct superBlock
 {
     uint64_t magic;
@@ -73,11 +77,43 @@ typedef struct superBlock
     block_index_t logAreaStart;
     block_index_t logAreaSize;
     uint64_t systemStateSeqNum;
-    uint16_t latestCheckpointIndex;
-    block_index_t checkpointArr[128];
+    uint32_t latestCheckpointIndex;     // ID of the latest checkpoint
+    block_index_t checkpointArr[NUM_CHECKPOINTS];
     bool readOnly;
+    block_index_t metadataDeviceBlocks; // blocks on the fast (metadata) device, 0 when there is a single device
+    block_index_t dataDeviceBlocks;     // blocks on the slow (data) device, 0 when there is a single device
+    block_index_t logDeviceBlocks;      // blocks on the external log device, 0 when the log is on the main device
+    block_index_t blockGroupCount;      // 0 for the flat layout
+    block_index_t blocksPerGroup;
+    inode_index_t inodesPerGroup;
+    block_index_t groupDescriptorTable;
+    block_index_t groupDescriptorTableSize;
 } superBlock_t;
 
+// Each block group holds one data bitmap block and one inode bitmap block, so a group spans as many blocks as a
+// bitmap block has bits, and inode locations advance by the same amount from one group to the next (only the
+// first inodesPerGroup locations of each group exist).
+constexpr block_index_t BLOCKS_PER_GROUP = BlockManager::BLOCK_SIZE * 8;
+constexpr inode_index_t INODE_LOCATIONS_PER_GROUP = BlockManager::BLOCK_SIZE * 8;
+
+typedef struct groupDescriptor
+{
+    block_index_t dataBitmapBlock;
+    block_index_t inodeBitmapBlock;
+    block_index_t inodeRegionStart;
+    block_index_t blockCount;           // blocks in the group, including its bitmaps and inode slots
+    block_index_t freeBlockCount;       // as of the last checkpoint
+    inode_index_t freeInodeCount;       // as of the last checkpoint
+    uint32_t reserved[2];
+} groupDescriptor_t;
+
+constexpr uint16_t GROUP_DESCRIPTORS_PER_BLOCK = BlockManager::BLOCK_SIZE / sizeof(groupDescriptor_t);
+
+typedef struct groupDescriptorBlock
+{
+    groupDescriptor_t descriptors[GROUP_DESCRIPTORS_PER_BLOCK];
+} groupDescriptorBlock_t;
+
 typedef struct bitmapBlock
 {
     uint64_t parts[512];
@@ -136,6 +172,7 @@ typedef union block
     bitmapBlock_t bitmapBlock;
     inodeTableBlock_t inodeTable;
     directoryBlock_t directoryBlock;
+    groupDescriptorBlock_t groupDescriptorBlock;
 } block_t;
 
 } // namespace fs
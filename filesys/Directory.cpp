@@ -11,8 +11,9 @@
 namespace fs {
 
 Directory::Directory(InodeTable* inodeTable, BitmapManager* inodeBitmap, BitmapManager* blockBitmap,
-                     BlockManager* blockManager, LogManager* logManager, const uint16_t permissions): File(
-    inodeTable, inodeBitmap, blockBitmap, blockManager, logManager, permissions)
+                     BlockManager* blockManager, LogManager* logManager, const uint16_t permissions,
+                     const inode_index_t inodeGoal): File(
+    inodeTable, inodeBitmap, blockBitmap, blockManager, logManager, permissions, inodeGoal)
 {
 }
 
@@ -111,17 +112,12 @@ bool Directory::addDirectoryEntry(const char* fileName, inode_index_t fileNum)
         inode.numFiles++;
 //        std::cout << "DEBUG: Updated inode numFiles to " << inode.numFiles << " for directory inode " << getInodeNumber() << std::endl;
         // Allocate a new block for the updated directory block.
-        block_index_t newBlockLocation = blockBitmap->findNextFree();
+        block_index_t newBlockLocation = blockBitmap->allocate(inode.directBlocks[inode.blockCount - 1]);
         if (newBlockLocation == BLOCK_NULL_VALUE)
         {
             printf("No free block available for copy-on-write directory update\n");
             return false;
         }
-        if (!blockBitmap->setAllocated(newBlockLocation))
-        {
-            printf("Failed to mark new block as allocated\n");
-            return false;
-        }
 //        std::cout << "DEBUG: Allocated new copy-on-write directory block at physical block " << newBlockLocation << " for directory inode " << getInodeNumber() << std::endl;
 
         // Write the new block data to disk.
@@ -139,38 +135,7 @@ bool Directory::addDirectoryEntry(const char* fileName, inode_index_t fileNum)
         inode.directBlocks[inode.blockCount - 1] = newBlockLocation;
 
         // --- Perform copy-on-write update on the parent's inode ---
-        inode_index_t newInodeLocation = inodeBitmap->findNextFree();
-        if (newInodeLocation == NULL_INDEX) {
-            printf("Failed to allocate new inode for copy-on-write update\n");
-            return false;
-        }
-        if (!inodeBitmap->setAllocated(newInodeLocation)) {
-            printf("Failed to mark new inode as allocated\n");
-            return false;
-        }
-        // Create a new parent's inode by copying the updated inode.
-        inode_t newParentInode = inode;
-        // Write the new inode to disk.
-        if (!inodeTable->writeInode(newInodeLocation, newParentInode)) {
-            printf("Failed to write updated parent's inode to disk\n");
-            return false;
-        }
-        // Log the parent's inode update.
-        {
-            LogRecordPayload payload{};
-            payload.inodeUpdate.inodeIndex = getInodeNumber();
-            payload.inodeUpdate.inodeLocation = newInodeLocation;
-            if (!logManager->logOperation(LogOpType::LOG_OP_INODE_UPDATE, &payload)) {
-                printf("Failed to log parent's inode update\n");
-                return false;
-            }
-        }
-        // Update the inode table to point to the new parent's inode location.
-        if (!inodeTable->setInodeLocation(getInodeNumber(), newInodeLocation)) {
-            printf("Failed to update inode table for parent's inode\n");
-            return false;
-        }
-        return true;
+        return commitInode();
     }
 }
 
@@ -204,12 +169,17 @@ bool Directory::removeDirectoryEntry(const char* fileName) {
                 }
 
                 // Log the deletion of the inode by creating a deletion log record.
+                const inode_index_t removedInode = block.directoryBlock.entries[j].inodeNumber;
+                const inode_index_t removedLocation = inodeTable->getInodeLocation(removedInode);
                 LogRecordPayload payload{};
-                payload.inodeDelete.inodeIndex = block.directoryBlock.entries[j].inodeNumber;
+                payload.inodeDelete.inodeIndex = removedInode;
                 if (!logManager->logOperation(LogOpType::LOG_OP_INODE_DELETE, &payload)) {
                     printf("Failed to log inode deletion\n");
                     return false;
                 }
+                // Logging it unmapped the inode, as replay does; the number goes back to the free pool and the
+                // slot is released.
+                inodeTable->releaseInodeSlot(removedLocation);
 
                 // Prepare a new copy of the directory block (copy-on-write).
                 block_t newBlock;
@@ -237,15 +207,11 @@ bool Directory::removeDirectoryEntry(const char* fileName) {
                         memset(lastBlock.directoryBlock.entries[lastOffset].name, 0, MAX_FILE_NAME_LENGTH + 1);
                         lastBlock.directoryBlock.entries[lastOffset].inodeNumber = INODE_NULL_VALUE;
                         // Perform copy-on-write update for the last block.
-                        block_index_t newLastBlock = blockBitmap->findNextFree();
+                        block_index_t newLastBlock = blockBitmap->allocate(inode.directBlocks[lastBlockIndex]);
                         if (newLastBlock == BLOCK_NULL_VALUE) {
                             printf("No free block for copy-on-write update of last block\n");
                             return false;
                         }
-                        if (!blockBitmap->setAllocated(newLastBlock)) {
-                            printf("Failed to set allocated for new last block\n");
-                            return false;
-                        }
                         if (!blockManager->writeBlock(newLastBlock, lastBlock.data)) {
                             printf("Failed to write updated last block\n");
                             return false;
@@ -268,15 +234,11 @@ bool Directory::removeDirectoryEntry(const char* fileName) {
 
 
                 // Now, perform a copy-on-write update for the directory block where deletion occurred.
-                block_index_t newBlockLocation = blockBitmap->findNextFree();
+                block_index_t newBlockLocation = blockBitmap->allocate(inode.directBlocks[i]);
                 if (newBlockLocation == BLOCK_NULL_VALUE) {
                     printf("No free block available for copy-on-write directory update\n");
                     return false;
                 }
-                if (!blockBitmap->setAllocated(newBlockLocation)) {
-                    printf("Failed to set allocated for new directory block\n");
-                    return false;
-                }
                 if (!blockManager->writeBlock(newBlockLocation, newBlock.data)) {
                     printf("Failed to write new directory block\n");
                     return false;
@@ -285,38 +247,7 @@ bool Directory::removeDirectoryEntry(const char* fileName) {
                 inode.directBlocks[i] = newBlockLocation;
 
                 // --- Perform copy-on-write update on the parent's inode ---
-                inode_index_t newInodeLocation = inodeBitmap->findNextFree();
-                if (newInodeLocation == NULL_INDEX) {
-                    printf("Failed to allocate new inode for copy-on-write update in removeDirectoryEntry\n");
-                    return false;
-                }
-                if (!inodeBitmap->setAllocated(newInodeLocation)) {
-                    printf("Failed to mark new inode as allocated in removeDirectoryEntry\n");
-                    return false;
-                }
-                // Create a new parent's inode by copying the updated inode.
-                inode_t newParentInode = inode;
-                // Write the new inode to disk.
-                if (!inodeTable->writeInode(newInodeLocation, newParentInode)) {
-                    printf("Failed to write updated parent's inode to disk in removeDirectoryEntry\n");
-                    return false;
-                }
-                // Log the parent's inode update.
-                {
-                    LogRecordPayload payload{};
-                    payload.inodeUpdate.inodeIndex = getInodeNumber();
-                    payload.inodeUpdate.inodeLocation = newInodeLocation;
-                    if (!logManager->logOperation(LogOpType::LOG_OP_INODE_UPDATE, &payload)) {
-                        printf("Failed to log parent's inode update in removeDirectoryEntry\n");
-                        return false;
-                    }
-                }
-                // Update the inode table to point to the new parent's inode location.
-                if (!inodeTable->setInodeLocation(getInodeNumber(), newInodeLocation)) {
-                    printf("Failed to update inode table for parent's inode in removeDirectoryEntry\n");
-                    return false;
-                }
-                return true;
+                return commitInode();
 
             }
         }
@@ -371,7 +302,9 @@ std::vector<char*> Directory::listDirectoryEntries() const
 
 Directory* Directory::createDirectory(const char* name)
 {
-    auto* newDir = new Directory(inodeTable, inodeBitmap, blockBitmap, blockManager, logManager);
+    // New inodes go next to their parent's.
+    auto* newDir = new Directory(inodeTable, inodeBitmap, blockBitmap, blockManager, logManager, DIRECTORY_MASK,
+                                 inodeLocation);
     if (!addDirectoryEntry(name, newDir->getInodeNumber()))
     {
         return nullptr;
@@ -381,7 +314,7 @@ Directory* Directory::createDirectory(const char* name)
 
 File* Directory::createFile(const char* name)
 {
-    auto* newFile = new File(inodeTable, inodeBitmap, blockBitmap, blockManager, logManager);
+    auto* newFile = new File(inodeTable, inodeBitmap, blockBitmap, blockManager, logManager, 0, inodeLocation);
     if (!addDirectoryEntry(name, newFile->getInodeNumber()))
     {
         return nullptr;
@@ -15,7 +15,7 @@ class Directory : public File
 public:
     Directory(InodeTable* inodeTable, BitmapManager* inodeBitmap, BitmapManager* blockBitmap,
               BlockManager* blockManager, LogManager* logManager,
-              uint16_t permissions = DIRECTORY_MASK);
+              uint16_t permissions = DIRECTORY_MASK, inode_index_t inodeGoal = INODE_NULL_VALUE);
     Directory(inode_index_t inodeNum, InodeTable* inodeTable, BitmapManager* inodeBitmap, BitmapManager* blockBitmap,
               BlockManager* blockManager, LogManager* logManager);
     inode_index_t getDirectoryEntry(const char* fileName) const;
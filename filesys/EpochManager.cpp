@@ -0,0 +1,168 @@
+#include "EpochManager.h"
+#ifdef NOT_KERNEL
+#include "thread"
+#include "unordered_map"
+#endif
+
+namespace fs {
+
+#ifdef NOT_KERNEL
+static std::atomic<uint64_t> nextInstanceId{0};
+
+EpochManager::EpochManager(): instanceId(nextInstanceId++)
+{
+}
+
+EpochManager::~EpochManager()
+{
+    // No guard can be held on a manager that is being destroyed.
+    for (const auto& object : retired)
+    {
+        object.reclaim(object.context, object.value);
+    }
+}
+
+EpochManager::threadRecord* EpochManager::record()
+{
+    thread_local std::unordered_map<uint64_t, threadRecord*> threadRecords;
+    const auto it = threadRecords.find(instanceId);
+    if (it != threadRecords.end())
+    {
+        return it->second;
+    }
+    std::lock_guard<std::mutex> lock(recordMutex);
+    records.push_back(std::make_unique<threadRecord>());
+    threadRecords[instanceId] = records.back().get();
+    return records.back().get();
+}
+
+void EpochManager::enter()
+{
+    threadRecord* rec = record();
+    if (rec->depth++ != 0)
+    {
+        return;
+    }
+    // The epoch has to be published before any shared pointer is loaded, and still be current once it is, or a
+    // reclaimer that advanced in between could free what this reader is about to load.
+    uint64_t epoch = globalEpoch.load();
+    while (true)
+    {
+        rec->epoch.store(epoch);
+        const uint64_t current = globalEpoch.load();
+        if (current == epoch)
+        {
+            return;
+        }
+        epoch = current;
+    }
+}
+
+void EpochManager::leave()
+{
+    threadRecord* rec = record();
+    if (--rec->depth == 0)
+    {
+        rec->epoch.store(IDLE, std::memory_order_release);
+    }
+}
+
+void EpochManager::retire(void (*reclaim)(void*, uint64_t), void* context, const uint64_t value)
+{
+    std::lock_guard<std::mutex> lock(retireMutex);
+    retired.push_back({reclaim, context, value, globalEpoch.load()});
+    // Counting from the last scan rather than the list length keeps objects a scan had to leave from shifting
+    // every later scan off the batch boundary.
+    if (++retiredSinceReclaim >= RECLAIM_BATCH)
+    {
+        this->reclaim();
+    }
+}
+
+void EpochManager::synchronize()
+{
+    // Each pass advances the epoch once the readers of the previous one are gone, so two passes without readers
+    // empty the list.
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(retireMutex);
+            reclaim();
+            if (retired.empty())
+            {
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochManager::reclaim()
+{
+    retiredSinceReclaim = 0;
+    uint64_t epoch = globalEpoch.load();
+    bool canAdvance = true;
+    {
+        std::lock_guard<std::mutex> lock(recordMutex);
+        for (const auto& rec : records)
+        {
+            const uint64_t readerEpoch = rec->epoch.load();
+            if (readerEpoch != IDLE && readerEpoch != epoch)
+            {
+                canAdvance = false;
+                break;
+            }
+        }
+    }
+    if (canAdvance)
+    {
+        // Only reclaimers advance the epoch, and they hold retireMutex.
+        globalEpoch.store(++epoch);
+    }
+    // Readers are at most one epoch behind the global one, so objects retired two epochs back are unreachable.
+    size_t kept = 0;
+    for (const auto& object : retired)
+    {
+        if (object.epoch + 2 <= epoch)
+        {
+            object.reclaim(object.context, object.value);
+        }
+        else
+        {
+            retired[kept++] = object;
+        }
+    }
+    retired.resize(kept);
+}
+
+EpochManager::Guard::Guard(EpochManager& epochs): epochs(epochs)
+{
+    epochs.enter();
+}
+
+EpochManager::Guard::~Guard()
+{
+    epochs.leave();
+}
+#else
+EpochManager::EpochManager() = default;
+
+EpochManager::~EpochManager() = default;
+
+void EpochManager::retire(void (*reclaim)(void*, uint64_t), void* context, const uint64_t value)
+{
+    reclaim(context, value);
+}
+
+void EpochManager::synchronize()
+{
+}
+
+EpochManager::Guard::Guard(EpochManager&)
+{
+}
+
+EpochManager::Guard::~Guard() = default;
+#endif
+
+} // namespace fs
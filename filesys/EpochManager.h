@@ -0,0 +1,95 @@
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+#include "cstdint"
+#include "vector"
+#ifdef NOT_KERNEL
+#include "atomic"
+#include "memory"
+#include "mutex"
+#endif
+
+namespace fs {
+
+// Epoch-based reclamation for structures that are read without locks. A reader holds a Guard while it uses
+// pointers it loaded from shared state. A writer that unpublishes an object retires it instead of freeing it, and
+// the object is reclaimed once every reader that could still hold it has dropped its guard: the global epoch only
+// advances when all active readers have seen the current one, so anything retired two epochs back is unreachable.
+//
+// The kernel build runs filesystem requests on one thread, so guards do nothing there and retired objects are
+// reclaimed immediately.
+class EpochManager
+{
+public:
+    EpochManager();
+    ~EpochManager();
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Guards may nest; only the outermost one on a thread enters and leaves the epoch.
+    class Guard
+    {
+    public:
+        explicit Guard(EpochManager& epochs);
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+#ifdef NOT_KERNEL
+        EpochManager& epochs;
+#endif
+    };
+
+    // Calls reclaim(context, value) once no reader can still be using what was unpublished.
+    void retire(void (*reclaim)(void* context, uint64_t value), void* context, uint64_t value = 0);
+
+    template <typename T>
+    void retire(T* object)
+    {
+        retire([](void* context, uint64_t) { delete static_cast<T*>(context); }, object);
+    }
+
+    // Waits until every reader active now has left and reclaims everything retired so far. The calling thread must
+    // not hold a guard on this manager.
+    void synchronize();
+
+private:
+#ifdef NOT_KERNEL
+    struct retiredObject
+    {
+        void (*reclaim)(void*, uint64_t);
+        void* context;
+        uint64_t value;
+        uint64_t epoch;                   // global epoch when it was retired
+    };
+
+    static constexpr uint64_t IDLE = UINT64_MAX;
+    // Retired objects are only scanned once this many have been retired since the last scan, so most retires just
+    // append.
+    static constexpr size_t RECLAIM_BATCH = 64;
+
+    struct threadRecord
+    {
+        std::atomic<uint64_t> epoch{IDLE};  // epoch the thread is reading in, IDLE outside a guard
+        uint32_t depth = 0;                 // guard nesting, only touched by the owning thread
+    };
+
+    threadRecord* record();
+    void enter();
+    void leave();
+    // Advances the global epoch if every active reader is in it, then reclaims what is old enough. Called with
+    // retireMutex held.
+    void reclaim();
+
+    const uint64_t instanceId;            // key of this manager in each thread's record map
+    std::atomic<uint64_t> globalEpoch{0};
+    std::mutex recordMutex;               // guards records (registration only)
+    std::vector<std::unique_ptr<threadRecord>> records;
+    std::mutex retireMutex;               // guards retired
+    std::vector<retiredObject> retired;
+    size_t retiredSinceReclaim = 0;
+#endif
+};
+
+} // namespace fs
+#endif //EPOCHMANAGER_H
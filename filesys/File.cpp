@@ -8,6 +8,7 @@
 #include "cassert"
 #include "cstdio"
 #include "algorithm"
+#include "vector"
 
 #include "BitmapManager.h"
 #include "InodeTable.h"
@@ -17,14 +18,14 @@ namespace fs
 {
     File::File(InodeTable* inodeTable, BitmapManager* inodeBitmap, BitmapManager* blockBitmap,
                BlockManager* blockManager,
-               LogManager* logManager, const uint16_t permissions)
+               LogManager* logManager, const uint16_t permissions, const inode_index_t inodeGoal)
         : inodeTable(inodeTable), inodeBitmap(inodeBitmap), blockBitmap(blockBitmap), blockManager(blockManager),
           logManager(logManager)
     {
-        inodeLocation = inodeBitmap->findNextFree();
-        if (!inodeBitmap->setAllocated(inodeLocation))
+        inodeLocation = inodeTable->allocateInodeSlot(inodeGoal);
+        if (inodeLocation == INODE_NULL_VALUE)
         {
-            printf("Could not set inode bit\n");
+            printf("Could not allocate inode\n");
             assert(0);
         }
         inode.size = 0;
@@ -69,12 +70,13 @@ namespace fs
             printf("log manager not initialized\n");
             assert(0);
         }
-        logManager->logOperation(LogOpType::LOG_OP_INODE_ADD, &payload);
-        if (!inodeTable->setInodeLocation(inodeNumber, inodeLocation))
+        // Logging the record also maps the inode number to its location.
+        if (!logManager->logOperation(LogOpType::LOG_OP_INODE_ADD, &payload))
         {
-            printf("Could not set inode location\n");
+            printf("Could not log inode creation\n");
             assert(0);
         }
+        inodeTable->cacheInode(inodeNumber, inodeLocation, inode);
 
         // std::cout << "Creating file with permissions: " << permissions << " with number " << inodeNumber << " at " <<
         // inodeLocation << std::endl;
@@ -87,12 +89,7 @@ namespace fs
                                                                     blockManager(blockManager), logManager(logManager),
                                                                     inodeNumber(inodeNumber)
     {
-        inodeLocation = inodeTable->getInodeLocation(inodeNumber);
-        if (inodeLocation == INODE_NULL_VALUE)
-        {
-            assert(0);
-        }
-        if (!inodeTable->readInode(inodeLocation, inode))
+        if (!inodeTable->readInodeByNumber(inodeNumber, inodeLocation, inode))
         {
             assert(0);
         }
@@ -104,6 +101,7 @@ namespace fs
         inodeBitmap = file->inodeBitmap;
         blockBitmap = file->blockBitmap;
         blockManager = file->blockManager;
+        logManager = file->logManager;
         inodeLocation = file->inodeLocation;
         inodeNumber = file->inodeNumber;
         inode = file->inode;
@@ -165,11 +163,15 @@ namespace fs
         return indirectBlock.indirectBlock.blockNumbers[blockOffset];
     }
 
-    block_index_t File::allocateAndWriteBlock(const uint8_t* data)
+    block_index_t File::allocateExtent(const block_index_t count, block_index_t& allocated, const block_index_t goal)
     {
-        block_index_t newBlock = blockBitmap->findNextFree();
+        return blockBitmap->allocateRange(count, 1, allocated, goal);
+    }
+
+    block_index_t File::allocateAndWriteBlock(const uint8_t* data, const block_index_t goal)
+    {
+        block_index_t newBlock = blockBitmap->allocate(goal);
         if (newBlock == BLOCK_NULL_VALUE) return BLOCK_NULL_VALUE;
-        if (!blockBitmap->setAllocated(newBlock)) return BLOCK_NULL_VALUE;
         if (!blockManager->writeBlock(newBlock, data)) return BLOCK_NULL_VALUE;
         return newBlock;
     }
@@ -196,15 +198,14 @@ namespace fs
 
     bool File::write_new_block_data(const uint8_t* data)
     {
-        block_index_t newBlock = blockBitmap->findNextFree();
+        const block_index_t goal = inode.blockCount > 0 && inode.blockCount <= NUM_DIRECT_BLOCKS
+                                       ? inode.directBlocks[inode.blockCount - 1] + 1
+                                       : BLOCK_NULL_VALUE;
+        block_index_t newBlock = blockBitmap->allocate(goal);
         if (newBlock == BLOCK_NULL_VALUE)
         {
             return false;
         }
-        if (!blockBitmap->setAllocated(newBlock))
-        {
-            return false;
-        }
         if (inode.blockCount < NUM_DIRECT_BLOCKS)
         {
             inode.directBlocks[inode.blockCount] = newBlock;
@@ -220,39 +221,36 @@ namespace fs
         }
         //    cout << "Writing new block data to block " << newBlock << endl;
 
-        // Perform copy-on-write update on the inode:
-        inode_index_t newInodeLocation = inodeBitmap->findNextFree();
-        if (newInodeLocation == NULL_INDEX)
-        {
-            printf("Failed to allocate new inode for copy-on-write update in write_new_block_data\n");
-            return false;
-        }
-        if (!inodeBitmap->setAllocated(newInodeLocation))
+        return commitInode();
+    }
+
+    bool File::commitInode()
+    {
+        inode_index_t newInodeLocation = inodeTable->allocateInodeSlot(inodeLocation);
+        if (newInodeLocation == INODE_NULL_VALUE)
         {
-            printf("Failed to mark new inode as allocated in write_new_block_data\n");
+            printf("Failed to allocate new inode for copy-on-write update of inode %d\n", inodeNumber);
             return false;
         }
-        inode_t newFileInode = inode;
-        if (!inodeTable->writeInode(newInodeLocation, newFileInode))
+        if (!inodeTable->writeInode(newInodeLocation, inode))
         {
-            printf("Failed to write updated inode to disk in write_new_block_data\n");
+            printf("Failed to write updated inode %d to disk\n", inodeNumber);
             return false;
         }
         LogRecordPayload payload{};
-        payload.inodeUpdate.inodeIndex = getInodeNumber();
+        payload.inodeUpdate.inodeIndex = inodeNumber;
         payload.inodeUpdate.inodeLocation = newInodeLocation;
         if (!logManager->logOperation(LogOpType::LOG_OP_INODE_UPDATE, &payload))
         {
-            printf("Failed to log inode update in write_new_block_data\n");
+            printf("Failed to log update of inode %d\n", inodeNumber);
             return false;
         }
         //    cout << "Updating inode table for inode " << getInodeNumber() << ": replacing location " << inodeLocation
         //         << " with new location " << newInodeLocation << std::endl;
-        if (!inodeTable->setInodeLocation(getInodeNumber(), newInodeLocation))
-        {
-            printf("Failed to update inode table for inode in write_new_block_data\n");
-            return false;
-        }
+        // Logging the update has already pointed the inode table at the new location.
+        inodeTable->releaseInodeSlot(inodeLocation);
+        inodeLocation = newInodeLocation;
+        inodeTable->cacheInode(inodeNumber, inodeLocation, inode);
         return true;
     }
 
@@ -272,7 +270,13 @@ namespace fs
         }
 
         uint64_t cur = offset;
-        block_t block;
+
+        // New data blocks are handed out from contiguous extents and each extent is written with one multi-block
+        // write once it is filled (or the write ends).
+        std::vector<uint8_t> extentData;
+        block_index_t extentStart = BLOCK_NULL_VALUE;
+        block_index_t extentLength = 0;
+        block_index_t extentUsed = 0;
 
         block_index_t indirectBlockNum = BLOCK_NULL_VALUE;
         block_t indirectBlock;
@@ -302,33 +306,56 @@ namespace fs
                 }
              */
 
+            if (extentUsed == extentLength)
+            {
+                if (extentUsed != 0 && !blockManager->writeBlocks(extentStart, extentUsed, extentData.data()))
+                {
+                    printf("Failed to write data extent\n");
+                    return false;
+                }
+                const block_index_t lastBlockNum = (offset + size - 1) / BlockManager::BLOCK_SIZE;
+                // Place the data right after the file's preceding block, or after the previous extent. A file's
+                // first block goes after its inode, which keeps it in the inode's block group (in the flat layout
+                // the inode region precedes the data region and the goal is ignored).
+                block_index_t goal = extentStart + extentLength;
+                if (extentStart == BLOCK_NULL_VALUE)
+                {
+                    goal = blockNum > 0 ? getBlockLocation(blockNum - 1) + 1 : inodeTable->getInodeBlock(inodeLocation) + 1;
+                }
+                extentStart = allocateExtent(std::min(lastBlockNum - blockNum + 1, MAX_EXTENT_BLOCKS), extentLength,
+                                             goal);
+                if (extentStart == BLOCK_NULL_VALUE)
+                {
+                    printf("Failed to allocate new block for copy-on-write update\n");
+                    return false;
+                }
+                extentData.resize(static_cast<size_t>(extentLength) * BlockManager::BLOCK_SIZE);
+                extentUsed = 0;
+            }
+            uint8_t* blockData = extentData.data() + static_cast<size_t>(extentUsed) * BlockManager::BLOCK_SIZE;
+
             // Case 1: New block allocation (set block to zero and copy data)
             if (isNew)
             {
-                memset(block.data, 0, BlockManager::BLOCK_SIZE);
-                memcpy(block.data + blockOffset, data + (cur - offset), toWrite);
+                memset(blockData, 0, BlockManager::BLOCK_SIZE);
+                memcpy(blockData + blockOffset, data + (cur - offset), toWrite);
                 inode.blockCount++;
             }
             // Case 2: Updating an already allocated block (copy-on-write update)
             else
             {
-                // Read the existing block into our temporary block.
-                if (!read_block_data(blockNum, block.data))
+                // Read the existing block unless it is being overwritten entirely.
+                if (toWrite != BlockManager::BLOCK_SIZE && !read_block_data(blockNum, blockData))
                 {
                     printf("Failed to read block %d\n", blockNum);
                     return false;
                 }
-                // Copy the old block contents (already in block.data) and apply modifications.
-                memcpy(block.data + blockOffset, data + (cur - offset), toWrite);
+                // Copy the old block contents (already in blockData) and apply modifications.
+                memcpy(blockData + blockOffset, data + (cur - offset), toWrite);
             }
 
-            // Always allocate a new block for the copy-on-write update
-            block_index_t newBlock = allocateAndWriteBlock(block.data);
-            if (newBlock == BLOCK_NULL_VALUE)
-            {
-                printf("Failed to allocate new block for copy-on-write update\n");
-                return false;
-            }
+            // Always use a new block for the copy-on-write update
+            block_index_t newBlock = extentStart + extentUsed++;
 
             if (blockNum < NUM_DIRECT_BLOCKS)
             {
@@ -342,7 +369,7 @@ namespace fs
                 {
                     if (indirectBlockNum != BLOCK_NULL_VALUE)
                     {
-                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data);
+                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data, extentStart + extentLength);
                         if (newIndirectBlock == BLOCK_NULL_VALUE)
                         {
                             printf("Failed to allocate new indirect block for copy-on-write update\n");
@@ -381,14 +408,14 @@ namespace fs
                     {
                         // should not be possible to have loaded in double indirect without an indirect block also loaded
                         assert(indirectBlockNum != BLOCK_NULL_VALUE);
-                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data);
+                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data, extentStart + extentLength);
                         if (newIndirectBlock == BLOCK_NULL_VALUE)
                         {
                             printf("Failed to allocate new indirect block for copy-on-write update\n");
                             return false;
                         }
                         doubleIndirectBlock.indirectBlock.blockNumbers[indirectBlockNum] = newIndirectBlock;
-                        block_index_t newDoubleIndirectBlock = allocateAndWriteBlock(doubleIndirectBlock.data);
+                        block_index_t newDoubleIndirectBlock = allocateAndWriteBlock(doubleIndirectBlock.data, extentStart + extentLength);
                         if (newDoubleIndirectBlock == BLOCK_NULL_VALUE)
                         {
                             printf("Failed to allocate new indirect block for copy-on-write update\n");
@@ -399,7 +426,7 @@ namespace fs
                     }
                     if (indirectBlockNum != BLOCK_NULL_VALUE)
                     {
-                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data);
+                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data, extentStart + extentLength);
                         if (newIndirectBlock == BLOCK_NULL_VALUE)
                         {
                             printf("Failed to allocate new indirect block for copy-on-write update\n");
@@ -435,7 +462,7 @@ namespace fs
                 {
                     if (indirectBlockNum != BLOCK_NULL_VALUE)
                     {
-                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data);
+                        block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data, extentStart + extentLength);
                         if (newIndirectBlock == BLOCK_NULL_VALUE)
                         {
                             printf("Failed to allocate new indirect block for copy-on-write update\n");
@@ -470,17 +497,23 @@ namespace fs
             cur += toWrite;
         }
 
+        if (extentUsed != 0 && !blockManager->writeBlocks(extentStart, extentUsed, extentData.data()))
+        {
+            printf("Failed to write data extent\n");
+            return false;
+        }
+
         if (doubleIndirectBlockNum != BLOCK_NULL_VALUE)
         {
             assert(indirectBlockNum != BLOCK_NULL_VALUE);
-            block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data);
+            block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data, extentStart + extentLength);
             if (newIndirectBlock == BLOCK_NULL_VALUE)
             {
                 printf("Failed to allocate new indirect block for copy-on-write update\n");
                 return false;
             }
             doubleIndirectBlock.indirectBlock.blockNumbers[indirectBlockNum] = newIndirectBlock;
-            block_index_t newDoubleIndirectBlock = allocateAndWriteBlock(doubleIndirectBlock.data);
+            block_index_t newDoubleIndirectBlock = allocateAndWriteBlock(doubleIndirectBlock.data, extentStart + extentLength);
             if (newDoubleIndirectBlock == BLOCK_NULL_VALUE)
             {
                 printf("Failed to allocate new indirect block for copy-on-write update\n");
@@ -493,7 +526,7 @@ namespace fs
 
         if (indirectBlockNum != BLOCK_NULL_VALUE)
         {
-            block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data);
+            block_index_t newIndirectBlock = allocateAndWriteBlock(indirectBlock.data, extentStart + extentLength);
             if (newIndirectBlock == BLOCK_NULL_VALUE)
             {
                 printf("Failed to allocate new indirect block for copy-on-write update\n");
@@ -510,43 +543,7 @@ namespace fs
         inode.size = std::max(offset + size, inode.size);
 
         // --- Perform copy-on-write update on the file's own inode ---
-        inode_index_t newInodeLocation = inodeBitmap->findNextFree();
-        if (newInodeLocation == NULL_INDEX)
-        {
-            printf("Failed to allocate new inode for copy-on-write update in write_at\n");
-            return false;
-        }
-        if (!inodeBitmap->setAllocated(newInodeLocation))
-        {
-            printf("Failed to mark new inode as allocated in write_at\n");
-            return false;
-        }
-        // Create a new file inode by copying the updated inode.
-        inode_t newFileInode = inode;
-        // Write the new inode to disk.
-        if (!inodeTable->writeInode(newInodeLocation, newFileInode))
-        {
-            printf("Failed to write updated file inode to disk in write_at\n");
-            return false;
-        }
-        // Log the file inode update.
-        {
-            LogRecordPayload payload{};
-            payload.inodeUpdate.inodeIndex = getInodeNumber();
-            payload.inodeUpdate.inodeLocation = newInodeLocation;
-            if (!logManager->logOperation(LogOpType::LOG_OP_INODE_UPDATE, &payload))
-            {
-                printf("Failed to log inode update for file write in write_at\n");
-                return false;
-            }
-        }
-        // Update the inode table to point to the new file inode location.
-        if (!inodeTable->setInodeLocation(getInodeNumber(), newInodeLocation))
-        {
-            printf("Failed to update inode table for file inode in write_at\n");
-            return false;
-        }
-        return true;
+        return commitInode();
     }
 
 
@@ -558,21 +555,39 @@ namespace fs
             printf("Offset out of bounds\n");
             return false;
         }
-        uint64_t cur = offset;
-        block_t block{};
-        while (cur < offset + size)
+        if (size == 0)
         {
-            block_index_t blockNum = cur / BlockManager::BLOCK_SIZE;
-            uint64_t blockOffset = cur % BlockManager::BLOCK_SIZE;
-            uint64_t toRead = std::min(BlockManager::BLOCK_SIZE - blockOffset, size - (cur - offset));
-            // std::cout << "cur: " << cur << ", blockNum: " << blockNum << ", blockOffset: " << blockOffset
-            //     << ", toRead: " << toRead << std::endl;
-            if (!read_block_data(blockNum, block.data))
+            return true;
+        }
+        const block_index_t firstBlockNum = offset / BlockManager::BLOCK_SIZE;
+        const block_index_t lastBlockNum = (offset + size - 1) / BlockManager::BLOCK_SIZE;
+        std::vector<uint8_t> runData;
+        block_index_t blockNum = firstBlockNum;
+        block_index_t location = getBlockLocation(blockNum);
+        while (blockNum <= lastBlockNum)
+        {
+            // Blocks that sit next to each other on disk are read together.
+            const block_index_t runStart = location;
+            block_index_t runLength = 1;
+            while (blockNum + runLength <= lastBlockNum)
+            {
+                location = getBlockLocation(blockNum + runLength);
+                if (runLength == MAX_EXTENT_BLOCKS || location != runStart + runLength)
+                {
+                    break;
+                }
+                runLength++;
+            }
+            runData.resize(static_cast<size_t>(runLength) * BlockManager::BLOCK_SIZE);
+            if (!blockManager->readBlocks(runStart, runLength, runData.data()))
             {
                 return false;
             }
-            memcpy(data + cur - offset, block.data + blockOffset, toRead);
-            cur += toRead;
+            const uint64_t runBegin = static_cast<uint64_t>(blockNum) * BlockManager::BLOCK_SIZE;
+            const uint64_t from = std::max(offset, runBegin);
+            const uint64_t to = std::min(offset + size, runBegin + runData.size());
+            memcpy(data + from - offset, runData.data() + from - runBegin, to - from);
+            blockNum += runLength;
         }
         return true;
     }
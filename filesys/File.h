@@ -12,8 +12,9 @@ namespace fs {
 class File
 {
 public:
+    // inodeGoal is an inode slot (such as the parent directory's) to place the new inode near.
     File(InodeTable* inodeTable, BitmapManager* inodeBitmap, BitmapManager* blockBitmap, BlockManager* blockManager, LogManager* logManager,
-         uint16_t permissions = 0);
+         uint16_t permissions = 0, inode_index_t inodeGoal = INODE_NULL_VALUE);
     File(inode_index_t inodeNumber, InodeTable* inodeTable, BitmapManager* inodeBitmap, BitmapManager* blockBitmap,
          BlockManager* blockManager, LogManager* logManager);
     explicit File(const File* file);
@@ -42,10 +43,18 @@ protected:
     bool read_block_data(block_index_t blockNum, uint8_t* data) const;
     bool write_block_data(block_index_t blockNum, const uint8_t* data);
     bool write_new_block_data(const uint8_t* data);
+    // Copy-on-write update of the inode: writes it to a new slot near the current one, logs the move and points
+    // the inode table (and the inode cache) at the new slot.
+    bool commitInode();
 
 private:
+    // Upper bound on the blocks moved by a single multi-block read or write.
+    static constexpr block_index_t MAX_EXTENT_BLOCKS = 64;
+
     block_index_t getBlockLocation(block_index_t blockNum) const;
-    block_index_t allocateAndWriteBlock(const uint8_t* data);
+    // Allocates a contiguous run of up to count blocks at or after goal, storing its length in allocated.
+    block_index_t allocateExtent(block_index_t count, block_index_t& allocated, block_index_t goal);
+    block_index_t allocateAndWriteBlock(const uint8_t* data, block_index_t goal = BLOCK_NULL_VALUE);
 };
 
 } // namespace fs
@@ -7,34 +7,40 @@
 #include "cstring"
 #include "cstdio"
 #include "cassert"
+#include "algorithm"
 
 
 #include "Directory.h"
+#include "../interface/TieredBlockManager.h"
 
 namespace fs {
 
-static const block_index_t LOG_AREA_SIZE = 64; // Reserve 64 blocks for the log area, need to adjust this later
-static const uint32_t NUM_CHECKPOINTS = 128;
+static const block_index_t LOG_AREA_SIZE = 64; // Default log area on the main device
 
 // Do not remove.
 FileSystem* FileSystem::instance = nullptr;
 InodeTable* FileSystem::liveTable = nullptr;
 
-FileSystem* FileSystem::getInstance(BlockManager* blockManager) {
+FileSystem* FileSystem::getInstance(BlockManager* blockManager, const FileSystemOptions& options) {
     if (!instance) {
-        instance = new FileSystem(blockManager);
+        instance = new FileSystem(blockManager, options);
     }
     return instance;
 }
 
-FileSystem::FileSystem(BlockManager* blockManager): blockManager(blockManager), inodeBitmap(nullptr),
-                                                    blockBitmap(nullptr)
+FileSystem::FileSystem(BlockManager* blockManager, const FileSystemOptions& options): blockManager(blockManager),
+    inodeBitmap(nullptr), blockBitmap(nullptr), options(options)
 {
     // Check if blockManager is nullptr.
     if (!blockManager) {
         printf("Block manager is nullptr\n");
         assert(0);
     }
+    // With a separate data device, everything below the metadata device's size addresses the fast device and
+    // everything above it addresses the data device.
+    if (options.dataBlockManager) {
+        this->blockManager = new TieredBlockManager(blockManager, options.dataBlockManager);
+    }
 
     this->superBlock = &superBlockWrapper.superBlock;
     if (!blockManager->readBlock(0, superBlockWrapper.data))
@@ -51,10 +57,50 @@ FileSystem::FileSystem(BlockManager* blockManager): blockManager(blockManager),
     else
     {
         printf("Existing filesystem detected\n");
+        if (superBlock->dataDeviceBlocks != (options.dataBlockManager ? options.dataBlockManager->getNumBlocks() : 0))
+        {
+            printf("Data device does not match the one the filesystem was created with\n");
+            assert(0);
+        }
+        if ((superBlock->logDeviceBlocks != 0) != (options.logBlockManager != nullptr))
+        {
+            printf("Log device does not match the one the filesystem was created with\n");
+            assert(0);
+        }
     }
     loadFilesystem();
 }
 
+bool FileSystem::destroyInstance()
+{
+    if (!instance)
+    {
+        return true;
+    }
+    const bool unmounted = instance->unmount();
+    delete instance;
+    instance = nullptr;
+    return unmounted;
+}
+
+FileSystem::~FileSystem()
+{
+    delete logManager;
+    for (const auto& entry : snapshotTables)
+    {
+        delete entry.second;
+    }
+    // While a snapshot is mounted inodeTable is one of the snapshot tables and the live one is parked in liveTable.
+    delete (readOnly ? liveTable : inodeTable);
+    liveTable = nullptr;
+    delete inodeBitmap;
+    delete blockBitmap;
+    if (options.dataBlockManager)
+    {
+        delete blockManager;
+    }
+}
+
 Directory* FileSystem::getRootDirectory() const
 {
     return new Directory(0, inodeTable, inodeBitmap, blockBitmap, blockManager, logManager);
@@ -64,6 +110,104 @@ Directory* FileSystem::getRootDirectory() const
 void FileSystem::createFilesystem()
 {
     superBlock->magic = MAGIC_NUMBER;
+    // An external log device frees the log area on the main device for data/metadata.
+    const block_index_t logBlocks = options.logBlockManager ? 0 : options.logBlockCount ? options.logBlockCount : LOG_AREA_SIZE;
+    if (options.blockGroups)
+    {
+        if (options.dataBlockManager)
+        {
+            printf("Block groups are not supported with a separate data device\n");
+            assert(0);
+        }
+        computeBlockGroupLayout(logBlocks);
+    }
+    else if (options.dataBlockManager)
+    {
+        computeTieredLayout(blockManager->getNumBlocks() - options.dataBlockManager->getNumBlocks(),
+                            options.dataBlockManager->getNumBlocks(), logBlocks);
+    }
+    else
+    {
+        computeSingleDeviceLayout(logBlocks);
+    }
+    superBlock->logDeviceBlocks = 0;
+    if (options.logBlockManager)
+    {
+        const block_index_t deviceBlocks = options.logBlockManager->getNumBlocks();
+        if (options.logBlockStart >= deviceBlocks ||
+            options.logBlockCount > deviceBlocks - options.logBlockStart)
+        {
+            printf("Log range does not fit on the log device\n");
+            assert(0);
+        }
+        superBlock->logAreaStart = options.logBlockStart;
+        superBlock->logAreaSize = options.logBlockCount ? options.logBlockCount : deviceBlocks - options.logBlockStart;
+        superBlock->logDeviceBlocks = deviceBlocks;
+    }
+    if (superBlock->logAreaSize < 2)
+    {
+        printf("Log area needs at least 2 blocks\n");
+        assert(0);
+    }
+    superBlock->freeDataBlockCount = superBlock->dataBlockCount;
+    superBlock->freeInodeCount = superBlock->inodeCount;
+    superBlock->size = superBlock->dataBlockCount * BlockManager::BLOCK_SIZE;
+
+    // Initialize other fields.
+    superBlock->systemStateSeqNum = 0;
+    superBlock->latestCheckpointIndex = 0;
+    for (int i = 0; i < NUM_CHECKPOINTS; i++)
+    {
+        superBlock->checkpointArr[i] = 0;
+    }
+
+
+    // Zero out the bitmaps.
+    constexpr block_t zeroBlock{};
+    if (superBlock->blockGroupCount != 0)
+    {
+        initializeBlockGroups();
+    }
+    for (block_index_t i = 0; i < superBlock->dataBlockBitmapSize && superBlock->blockGroupCount == 0; i++)
+    {
+        if (!blockManager->writeBlock(superBlock->dataBlockBitmap + i, zeroBlock.data))
+        {
+            printf("Could not write block bitmap\n");
+            assert(0);
+        }
+    }
+
+    for (block_index_t i = 0; i < superBlock->inodeBitmapSize && superBlock->blockGroupCount == 0; i++)
+    {
+        if (!blockManager->writeBlock(superBlock->inodeBitmap + i, zeroBlock.data))
+        {
+            printf("Could not write inode bitmap\n");
+            assert(0);
+        }
+    }
+
+    InodeTable::initialize(superBlock->inodeTable, superBlock->inodeTableSize, blockManager);
+
+    // Mount finds the end of the log by checking records, so nothing a previous filesystem left there may pass.
+    BlockManager* logDevice = options.logBlockManager ? options.logBlockManager : blockManager;
+    for (block_index_t i = 0; i < superBlock->logAreaSize; i++)
+    {
+        if (!logDevice->writeBlock(superBlock->logAreaStart + i, zeroBlock.data))
+        {
+            printf("Could not clear log area\n");
+            assert(0);
+        }
+    }
+
+    if (!blockManager->writeBlock(0, superBlockWrapper.data))
+    {
+        printf("Could not write superblock\n");
+        assert(0);
+    }
+}
+
+void FileSystem::computeSingleDeviceLayout(const block_index_t logBlocks)
+{
     superBlock->totalBlockCount = blockManager->getNumBlocks() - 1;
     superBlock->inodeCount = 4 * (superBlock->totalBlockCount / 16);
     superBlock->inodeBitmapSize = ((superBlock->inodeCount + 7) / 8 + BlockManager::BLOCK_SIZE - 1)
@@ -82,16 +226,13 @@ void FileSystem::createFilesystem()
     superBlock->dataBlockBitmapSize = ((remainingBlocks + 7) / 8 + BlockManager::BLOCK_SIZE - 1) /
         BlockManager::BLOCK_SIZE;
 
-    // Reserve LOG_AREA_SIZE blocks for logging.
-    if (remainingBlocks < superBlock->dataBlockBitmapSize + LOG_AREA_SIZE)
+    // Reserve logBlocks blocks for logging.
+    if (remainingBlocks < superBlock->dataBlockBitmapSize + logBlocks)
     {
         printf("Not enough blocks remaining for data and log areas.\n");
         assert(0);
     }
-    superBlock->dataBlockCount = remainingBlocks - superBlock->dataBlockBitmapSize - LOG_AREA_SIZE;
-    superBlock->freeDataBlockCount = superBlock->dataBlockCount;
-    superBlock->freeInodeCount = superBlock->inodeCount;
-    superBlock->size = superBlock->dataBlockCount * BlockManager::BLOCK_SIZE;
+    superBlock->dataBlockCount = remainingBlocks - superBlock->dataBlockBitmapSize - logBlocks;
 
     // Layout: bitmaps and tables are laid out consecutively.
     superBlock->inodeBitmap = 1;
@@ -102,44 +243,193 @@ void FileSystem::createFilesystem()
 
     // Reserve the log area at the end of the disk.
     superBlock->logAreaStart = superBlock->dataBlockRegionStart + superBlock->dataBlockCount;
-    superBlock->logAreaSize = LOG_AREA_SIZE;
+    superBlock->logAreaSize = logBlocks;
+    superBlock->metadataDeviceBlocks = 0;
+    superBlock->dataDeviceBlocks = 0;
+    superBlock->blockGroupCount = 0;
+}
 
-    // Initialize other fields.
-    superBlock->systemStateSeqNum = 0;
-    superBlock->latestCheckpointIndex = 0;
-    for (int i = 0; i < NUM_CHECKPOINTS; i++)
+// Metadata (superblock, bitmaps, inode table, inode region and, unless it is external, the log) is packed onto
+// the fast device and the whole data device becomes the data region. The inode count follows the usual one
+// inode per four data blocks, shrunk if necessary until the inode structures fit on the fast device.
+void FileSystem::computeTieredLayout(const block_index_t metadataBlocks, const block_index_t dataBlocks,
+                                     const block_index_t logBlocks)
+{
+    superBlock->totalBlockCount = metadataBlocks + dataBlocks - 1;
+    superBlock->dataBlockCount = dataBlocks;
+    superBlock->dataBlockBitmapSize = ((dataBlocks + 7) / 8 + BlockManager::BLOCK_SIZE - 1) /
+        BlockManager::BLOCK_SIZE;
+
+    if (metadataBlocks < 1 + superBlock->dataBlockBitmapSize + logBlocks + 3)
     {
-        superBlock->checkpointArr[i] = 0;
+        printf("Metadata device too small for the data bitmap and log area.\n");
+        assert(0);
     }
-
-
-    // Zero out the bitmaps.
-    constexpr block_t zeroBlock{};
-    for (block_index_t i = 0; i < superBlock->dataBlockBitmapSize; i++)
+    const block_index_t inodeBudget = metadataBlocks - 1 - superBlock->dataBlockBitmapSize - logBlocks;
+    superBlock->inodeCount = 4 * (dataBlocks / 16);
+    while (true)
     {
-        if (!blockManager->writeBlock(superBlock->dataBlockBitmap + i, zeroBlock.data))
+        superBlock->inodeBitmapSize = ((superBlock->inodeCount + 7) / 8 + BlockManager::BLOCK_SIZE - 1) /
+            BlockManager::BLOCK_SIZE;
+        superBlock->inodeRegionSize = (superBlock->inodeCount * sizeof(inode_t) + BlockManager::BLOCK_SIZE - 1) /
+            BlockManager::BLOCK_SIZE;
+        superBlock->inodeTableSize = (superBlock->inodeCount * sizeof(inode_index_t) +
+            BlockManager::BLOCK_SIZE - 1) / BlockManager::BLOCK_SIZE;
+        const block_index_t needed = superBlock->inodeBitmapSize + superBlock->inodeRegionSize +
+            superBlock->inodeTableSize;
+        if (needed <= inodeBudget)
         {
-            printf("Could not write block bitmap\n");
+            break;
+        }
+        // Drop the inodes whose region/table blocks do not fit and try again.
+        superBlock->inodeCount -= std::min<inode_index_t>(superBlock->inodeCount,
+                                                          (needed - inodeBudget) * INODES_PER_BLOCK);
+        if (superBlock->inodeCount == 0)
+        {
+            printf("Metadata device too small for any inodes.\n");
             assert(0);
         }
     }
 
-    for (block_index_t i = 0; i < superBlock->inodeBitmapSize; i++)
+    superBlock->inodeBitmap = 1;
+    superBlock->inodeTable = superBlock->inodeBitmap + superBlock->inodeBitmapSize;
+    superBlock->dataBlockBitmap = superBlock->inodeTable + superBlock->inodeTableSize;
+    superBlock->inodeRegionStart = superBlock->dataBlockBitmap + superBlock->dataBlockBitmapSize;
+    superBlock->logAreaStart = superBlock->inodeRegionStart + superBlock->inodeRegionSize;
+    superBlock->logAreaSize = logBlocks;
+    superBlock->dataBlockRegionStart = metadataBlocks;
+
+    superBlock->metadataDeviceBlocks = metadataBlocks;
+    superBlock->dataDeviceBlocks = dataBlocks;
+    superBlock->blockGroupCount = 0;
+}
+
+// After the superblock come the group descriptor table, the inode table and the log area; the rest of the device
+// is cut into groups of BLOCKS_PER_GROUP blocks (the last one may be shorter). A group starts with its data
+// bitmap block, then its inode bitmap block and its inode slots, and the rest holds data. The data bitmap covers
+// every block of a group, with the group's own metadata blocks marked allocated, so bit i is still block
+// dataBlockRegionStart + i.
+void FileSystem::computeBlockGroupLayout(const block_index_t logBlocks)
+{
+    const block_index_t deviceBlocks = blockManager->getNumBlocks();
+    superBlock->totalBlockCount = deviceBlocks - 1;
+
+    // One inode per four blocks of a full group (or of the whole device, if it is smaller than a group).
+    const block_index_t sizingBlocks = std::min(BLOCKS_PER_GROUP, deviceBlocks);
+    const inode_index_t inodesPerGroup = (sizingBlocks / 4 + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK * INODES_PER_BLOCK;
+    const block_index_t groupMetadataBlocks = 2 + inodesPerGroup / INODES_PER_BLOCK;
+
+    // The fixed area is sized for the largest group count the device could hold.
+    const block_index_t maxGroups = (deviceBlocks + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+    superBlock->groupDescriptorTable = 1;
+    superBlock->groupDescriptorTableSize = (maxGroups + GROUP_DESCRIPTORS_PER_BLOCK - 1) / GROUP_DESCRIPTORS_PER_BLOCK;
+    superBlock->inodeTable = superBlock->groupDescriptorTable + superBlock->groupDescriptorTableSize;
+    superBlock->inodeTableSize = (maxGroups * inodesPerGroup * sizeof(inode_index_t) + BlockManager::BLOCK_SIZE - 1) /
+        BlockManager::BLOCK_SIZE;
+    superBlock->logAreaStart = superBlock->inodeTable + superBlock->inodeTableSize;
+    superBlock->logAreaSize = logBlocks;
+    superBlock->dataBlockRegionStart = superBlock->logAreaStart + logBlocks;
+
+    if (deviceBlocks < superBlock->dataBlockRegionStart + groupMetadataBlocks + 1)
     {
-        if (!blockManager->writeBlock(superBlock->inodeBitmap + i, zeroBlock.data))
+        printf("Not enough blocks for a single block group.\n");
+        assert(0);
+    }
+    const block_index_t available = deviceBlocks - superBlock->dataBlockRegionStart;
+    block_index_t groups = (available + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+    // A short last group that cannot hold its own metadata plus some data is left unused.
+    if (available - (groups - 1) * BLOCKS_PER_GROUP < groupMetadataBlocks + 1)
+    {
+        groups--;
+    }
+
+    superBlock->blockGroupCount = groups;
+    superBlock->blocksPerGroup = BLOCKS_PER_GROUP;
+    superBlock->inodesPerGroup = inodesPerGroup;
+    superBlock->dataBlockCount = std::min(available, groups * BLOCKS_PER_GROUP);
+    superBlock->inodeCount = groups * inodesPerGroup;
+    superBlock->dataBlockBitmap = superBlock->dataBlockRegionStart;
+    superBlock->dataBlockBitmapSize = groups;
+    superBlock->inodeBitmap = superBlock->dataBlockRegionStart + 1;
+    superBlock->inodeBitmapSize = groups;
+    superBlock->inodeRegionStart = superBlock->dataBlockRegionStart + 2;
+    superBlock->inodeRegionSize = inodesPerGroup / INODES_PER_BLOCK;
+
+    superBlock->metadataDeviceBlocks = 0;
+    superBlock->dataDeviceBlocks = 0;
+}
+
+// Writes each group's bitmap blocks (with the group's metadata blocks marked in use) and the descriptor table.
+void FileSystem::initializeBlockGroups()
+{
+    const block_index_t groupMetadataBlocks = 2 + superBlock->inodeRegionSize;
+    block_t bitmapBlock{};
+    for (block_index_t b = 0; b < groupMetadataBlocks; b++)
+    {
+        bitmapBlock.bitmapBlock.parts[b / 64] |= 1ULL << (b % 64);
+    }
+    constexpr block_t zeroBlock{};
+    block_t descriptorBlock{};
+    for (block_index_t g = 0; g < superBlock->blockGroupCount; g++)
+    {
+        const block_index_t groupStart = superBlock->dataBlockRegionStart + g * superBlock->blocksPerGroup;
+        if (!blockManager->writeBlock(groupStart, bitmapBlock.data) ||
+            !blockManager->writeBlock(groupStart + 1, zeroBlock.data))
         {
-            printf("Could not write inode bitmap\n");
+            printf("Could not write block group bitmaps\n");
             assert(0);
         }
-    }
 
-    InodeTable::initialize(superBlock->inodeTable, superBlock->inodeTableSize, blockManager);
+        groupDescriptor_t& descriptor = descriptorBlock.groupDescriptorBlock.descriptors[g % GROUP_DESCRIPTORS_PER_BLOCK];
+        descriptor.dataBitmapBlock = groupStart;
+        descriptor.inodeBitmapBlock = groupStart + 1;
+        descriptor.inodeRegionStart = groupStart + 2;
+        descriptor.blockCount = std::min(superBlock->blocksPerGroup,
+                                         superBlock->dataBlockCount - g * superBlock->blocksPerGroup);
+        descriptor.freeBlockCount = descriptor.blockCount - groupMetadataBlocks;
+        descriptor.freeInodeCount = superBlock->inodesPerGroup;
+        if (g % GROUP_DESCRIPTORS_PER_BLOCK == GROUP_DESCRIPTORS_PER_BLOCK - 1 || g == superBlock->blockGroupCount - 1)
+        {
+            if (!blockManager->writeBlock(superBlock->groupDescriptorTable + g / GROUP_DESCRIPTORS_PER_BLOCK,
+                                          descriptorBlock.data))
+            {
+                printf("Could not write group descriptor table\n");
+                assert(0);
+            }
+            descriptorBlock = block_t{};
+        }
+    }
+    superBlock->freeDataBlockCount = superBlock->dataBlockCount - superBlock->blockGroupCount * groupMetadataBlocks;
+}
 
-    if (!blockManager->writeBlock(0, superBlockWrapper.data))
+// Refreshes the free counts in the group descriptor table from the in-memory bitmaps.
+bool FileSystem::updateGroupDescriptors()
+{
+    block_t descriptorBlock;
+    for (block_index_t t = 0; t < superBlock->groupDescriptorTableSize; t++)
     {
-        printf("Could not write superblock\n");
-        assert(0);
+        if (!blockManager->readBlock(superBlock->groupDescriptorTable + t, descriptorBlock.data))
+        {
+            printf("Could not read group descriptor table\n");
+            return false;
+        }
+        for (block_index_t i = 0; i < GROUP_DESCRIPTORS_PER_BLOCK; i++)
+        {
+            const block_index_t g = t * GROUP_DESCRIPTORS_PER_BLOCK + i;
+            if (g >= superBlock->blockGroupCount)
+            {
+                break;
+            }
+            descriptorBlock.groupDescriptorBlock.descriptors[i].freeBlockCount = blockBitmap->getFreeCount(g);
+            descriptorBlock.groupDescriptorBlock.descriptors[i].freeInodeCount = inodeBitmap->getFreeCount(g);
+        }
+        if (!blockManager->writeBlock(superBlock->groupDescriptorTable + t, descriptorBlock.data))
+        {
+            printf("Could not write group descriptor table\n");
+            return false;
+        }
     }
+    return true;
 }
 
 void FileSystem::loadFilesystem()
@@ -147,16 +437,41 @@ void FileSystem::loadFilesystem()
     // std::cout << "Size: " << superBlock->size << std::endl;
     // std::cout << "Inode region start: " << superBlock->inodeRegionStart << std::endl;
     // std::cout << "Data block region start: " << superBlock->dataBlockRegionStart << std::endl;
-    inodeBitmap = new BitmapManager(superBlock->inodeBitmap, superBlock->inodeBitmapSize, superBlock->inodeCount,
-                                    blockManager);
-    blockBitmap = new BitmapManager(superBlock->dataBlockBitmap, superBlock->dataBlockBitmapSize,
-                                    superBlock->dataBlockCount, blockManager, superBlock->dataBlockRegionStart);
-    inodeTable = new InodeTable(superBlock->inodeTable, superBlock->inodeTableSize, superBlock->inodeCount,
-                                superBlock->inodeRegionStart,
-                                blockManager);
+    if (superBlock->blockGroupCount != 0)
+    {
+        // The bitmaps are spread over the groups, one block per group.
+        const block_index_t groups = superBlock->blockGroupCount;
+        inodeBitmap = new BitmapManager(superBlock->inodeBitmap, groups,
+                                        (groups - 1) * INODE_LOCATIONS_PER_GROUP + superBlock->inodesPerGroup,
+                                        blockManager, 0, superBlock->blocksPerGroup, superBlock->inodesPerGroup);
+        blockBitmap = new BitmapManager(superBlock->dataBlockBitmap, groups, superBlock->dataBlockCount, blockManager,
+                                        superBlock->dataBlockRegionStart, superBlock->blocksPerGroup);
+        inodeTable = new InodeTable(superBlock->inodeTable, superBlock->inodeTableSize, superBlock->inodeCount,
+                                    superBlock->inodeRegionStart, blockManager, superBlock->blocksPerGroup,
+                                    inodeBitmap);
+    }
+    else
+    {
+        inodeBitmap = new BitmapManager(superBlock->inodeBitmap, superBlock->inodeBitmapSize, superBlock->inodeCount,
+                                        blockManager);
+        blockBitmap = new BitmapManager(superBlock->dataBlockBitmap, superBlock->dataBlockBitmapSize,
+                                        superBlock->dataBlockCount, blockManager, superBlock->dataBlockRegionStart);
+        inodeTable = new InodeTable(superBlock->inodeTable, superBlock->inodeTableSize, superBlock->inodeCount,
+                                    superBlock->inodeRegionStart,
+                                    blockManager, 0, inodeBitmap);
+    }
+
+    const CheckpointPolicy& policy = options.checkpointPolicy;
+    if (policy.replayRecords == 1 ||
+        (policy.logFillPercent != 0 && uint64_t{policy.logFillPercent} * superBlock->logAreaSize <= 100))
+    {
+        printf("Checkpoint policy would checkpoint after every operation\n");
+        assert(0);
+    }
 
     // Initialize LogManager using the log area from the superblock.
-    logManager = new LogManager(blockManager, blockBitmap, inodeTable, superBlock->logAreaStart, superBlock->logAreaSize, superBlock->systemStateSeqNum);
+    logManager = new LogManager(blockManager, blockBitmap, inodeBitmap, inodeTable, superBlock,
+                                options.logBlockManager, options.logCommitIntervalMs, options.checkpointPolicy);
     if (inodeTable->getInodeLocation(0) == INODE_NULL_VALUE)
     {
         delete createRootInode();
@@ -166,7 +481,7 @@ void FileSystem::loadFilesystem()
 
 bool FileSystem::readInode(inode_index_t inodeLocation, inode_t& inode)
 {
-    block_index_t inodeBlock = superBlock->inodeRegionStart + inodeLocation / INODES_PER_BLOCK;
+    block_index_t inodeBlock = inodeTable->getInodeBlock(inodeLocation);
     block_t tempBlock;
     if (!blockManager->readBlock(inodeBlock, tempBlock.data))
     {
@@ -179,7 +494,7 @@ bool FileSystem::readInode(inode_index_t inodeLocation, inode_t& inode)
 
 bool FileSystem::writeInode(inode_index_t inodeLocation, inode_t& inode)
 {
-    block_index_t inodeBlock = superBlock->inodeRegionStart + inodeLocation / INODES_PER_BLOCK;
+    block_index_t inodeBlock = inodeTable->getInodeBlock(inodeLocation);
     block_t tempBlock;
     if (!blockManager->readBlock(inodeBlock, tempBlock.data))
     {
@@ -202,39 +517,67 @@ Directory* FileSystem::createRootInode()
 }
 
 bool FileSystem::createCheckpoint() {
-    return logManager->createCheckpoint();
+    // The bitmaps are written back by the log manager as part of logging the checkpoint.
+    const bool created = logManager->createCheckpoint();
+    if (superBlock->blockGroupCount != 0)
+    {
+        return updateGroupDescriptors() && created;
+    }
+    return created;
+}
+
+bool FileSystem::unmount()
+{
+    if (superBlock->blockGroupCount != 0 && !updateGroupDescriptors())
+    {
+        return false;
+    }
+    return logManager->unmount();
+}
+
+FileSystemUsage FileSystem::getUsage() const
+{
+    FileSystemUsage usage{};
+    usage.totalBlocks = superBlock->dataBlockCount;
+    if (superBlock->blockGroupCount != 0)
+    {
+        // The data bitmap also covers each group's own bitmap and inode blocks, which are never free.
+        usage.totalBlocks -= static_cast<uint64_t>(superBlock->blockGroupCount) * (2 + superBlock->inodeRegionSize);
+    }
+    usage.freeBlocks = blockBitmap->getFreeCount();
+    usage.totalInodes = superBlock->inodeCount;
+    usage.freeInodes = inodeBitmap->getFreeCount();
+    return usage;
 }
 
 // Modified mountReadOnlySnapshot using the new snapshot functionality.
 bool FileSystem::mountReadOnlySnapshot(uint32_t checkpointID) {
     if(checkpointID == 0){
+        if (instance->readOnly) {
+            logManager->unpinCheckpoint(mountedCheckpoint);
+        }
         instance->readOnly = false; // Mount the live filesystem
-        instance->inodeTable = liveTable; // Restore the live inode table
+        mountedCheckpoint = 0;
+        if (liveTable) {
+            instance->inodeTable = liveTable; // Restore the live inode table
+        }
         return true;
     }
 
-    // Read the superblock from disk.
-    block_t superBlockTemp;
-    if (!blockManager->readBlock(0, superBlockTemp.data)) {
-        printf("mountReadOnlySnapshot: Failed to read superblock\n");
-        return false;
-    }
-    // Validate checkpointID and obtain the checkpoint block index.
-    if (checkpointID >= 128) {
-        printf("mountReadOnlySnapshot: Invalid checkpointID\n");
-        return false;
-    }
-    block_index_t cpBlock = superBlockTemp.superBlock.checkpointArr[checkpointID];
-    if (cpBlock == 0) {
+    // Pinned before the lookup, so the checkpoint can't be dropped between finding and mounting it.
+    if (!logManager->pinCheckpoint(checkpointID)) {
         printf("mountReadOnlySnapshot: Checkpoint not available\n");
         return false;
     }
-    // Create a snapshot of the inode table from the checkpoint chain.
-    InodeTable* snapshotInodeTable = InodeTable::createSnapshotFromCheckpoint(cpBlock, this->inodeTable);
+    InodeTable* snapshotInodeTable = getSnapshotTable(checkpointID);
     if (!snapshotInodeTable) {
-        printf("mountReadOnlySnapshot: Failed to create snapshot inode table\n");
+        logManager->unpinCheckpoint(checkpointID);
         return false;
     }
+    if (instance->readOnly) {
+        logManager->unpinCheckpoint(mountedCheckpoint);
+    }
+    mountedCheckpoint = checkpointID;
     if(!instance->readOnly){
         liveTable = instance->inodeTable; // Store the live inode table.
     }
@@ -244,4 +587,34 @@ bool FileSystem::mountReadOnlySnapshot(uint32_t checkpointID) {
     return true;
 }
 
+InodeTable* FileSystem::getSnapshotTable(uint32_t checkpointID) {
+    // Tables of checkpoints that have been dropped since are let go, except the mounted one, whose checkpoint was
+    // kept allocated for it.
+    for (auto it = snapshotTables.begin(); it != snapshotTables.end();) {
+        if (it->second != inodeTable && logManager->getCheckpointBlock(it->first) == 0) {
+            delete it->second;
+            it = snapshotTables.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    block_index_t cpBlock = logManager->getCheckpointBlock(checkpointID);
+    const auto it = snapshotTables.find(checkpointID);
+    if (it != snapshotTables.end() && cpBlock != 0) {
+        return it->second;
+    }
+    if (cpBlock == 0) {
+        printf("mountReadOnlySnapshot: Checkpoint not available\n");
+        return nullptr;
+    }
+    // Create a snapshot of the inode table from the checkpoint chain.
+    InodeTable* snapshotInodeTable = InodeTable::createSnapshotFromCheckpoint(cpBlock, logManager->getInodeTable());
+    if (!snapshotInodeTable) {
+        printf("mountReadOnlySnapshot: Failed to create snapshot inode table\n");
+        return nullptr;
+    }
+    snapshotTables[checkpointID] = snapshotInodeTable;
+    return snapshotInodeTable;
+}
+
 } // namespace fs
\ No newline at end of file
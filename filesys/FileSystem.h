@@ -10,10 +10,52 @@
 #include "InodeTable.h"
 #include "../interface/BlockManager.h"
 #include "LogManager.h"
+#include "map"
+
+namespace fs {
+
+// Device and layout choices, only consulted when the filesystem instance is first created.
+struct FileSystemOptions {
+    // When set, file data lives on this device and the BlockManager passed to getInstance only holds the
+    // superblock, bitmaps, inode table, inode region and log area.
+    BlockManager* dataBlockManager = nullptr;
+
+    // When set, the log lives in [logBlockStart, logBlockStart + logBlockCount) on this device instead of in a
+    // reserved area of the main device.
+    BlockManager* logBlockManager = nullptr;
+    block_index_t logBlockStart = 0;
+    // Size of the log area. The log is reused as a ring, and filling it forces a checkpoint, so this bounds how
+    // much is replayed at mount rather than how long the filesystem can run. 0 means 64 blocks on the main device
+    // and the rest of the device for an external log. At least 2 blocks.
+    block_index_t logBlockCount = 0;
+
+    // Split the device into ext-style block groups, each with its own bitmap slices, inode slots and data, so an
+    // inode, its neighbours in the same directory and their data can be allocated close together. Single device
+    // only.
+    bool blockGroups = false;
+
+    // Group commit window. Operations normally return once their log record is on disk, sharing the write with
+    // whatever other threads logged meanwhile. With a non-zero interval they return as soon as the record is
+    // logged in memory, and records are written at most this many milliseconds later (or when the log entry fills
+    // or fs_req_sync is called), so a crash can lose the last interval's operations.
+    uint32_t logCommitIntervalMs = 0;
+
+    // Checkpoints taken in the background to bound recovery time (see CheckpointPolicy). All triggers
+    // are off by default, leaving checkpoints to fs_req_create_checkpoint and to the log filling up.
+    CheckpointPolicy checkpointPolicy;
+};
+
+// Capacity figures for statfs. Blocks are data blocks; inodes are inode slots, which copy-on-write updates consume
+// as well as file creation.
+struct FileSystemUsage {
+    uint64_t totalBlocks;
+    uint64_t freeBlocks;
+    uint64_t totalInodes;
+    uint64_t freeInodes;
+};
 
 // Make filesystem a singleton (at most one global instance is allowed to exist).
 // Don't call constructor directly, use getInstance instead.
-namespace fs {
 class FileSystem {
 public:
     // Delete copy constructor and assignment operator.
@@ -21,7 +63,7 @@ public:
     void operator=(const FileSystem &) = delete;
 
     // Get the singleton instance.
-    static FileSystem* getInstance(BlockManager *blockManager = nullptr);
+    static FileSystem* getInstance(BlockManager *blockManager = nullptr, const FileSystemOptions &options = {});
 
     Directory* getRootDirectory() const;
     bool createCheckpoint();
@@ -29,9 +71,25 @@ public:
     // Mount a read-only snapshot based on a checkpoint ID.
     // Returns a new FileSystem instance representing the snapshot, or nullptr on failure.
     bool mountReadOnlySnapshot(uint32_t checkpointID);
+    // Read-only inode table for a checkpoint. Tables are created on first use and kept, so any number of
+    // snapshots can be open at once and switching back to one is free; each costs only the checkpoint blocks its
+    // lookups have touched.
+    InodeTable* getSnapshotTable(uint32_t checkpointID);
 
     bool isReadOnly() const { return readOnly; }
 
+    // The superblock is read once at mount and kept in memory; only checkpoints and unmount write it back.
+    const superBlock_t* getSuperBlock() const { return superBlock; }
+
+    // Makes the log durable and writes the superblock, so the next mount need not look for the end of the log.
+    bool unmount();
+
+    // Unmounts the filesystem and destroys the instance, so the next getInstance mounts the device afresh.
+    static bool destroyInstance();
+
+    // Served from the bitmaps' live counters without any disk access.
+    FileSystemUsage getUsage() const;
+
     // make public for now
     InodeTable *inodeTable;
     BitmapManager *inodeBitmap;
@@ -41,12 +99,15 @@ public:
 
 private:
     // Constructor is private, so it can't be called directly.
-    explicit FileSystem(BlockManager *blockManager);
+    FileSystem(BlockManager *blockManager, const FileSystemOptions &options);
+    ~FileSystem();
     static FileSystem* instance;
     static InodeTable* liveTable;
+    std::map<uint32_t, InodeTable*> snapshotTables;
+    uint32_t mountedCheckpoint = 0;
 
     bool readOnly = false; // default false
-
+    FileSystemOptions options;
 
 
 
@@ -55,6 +116,11 @@ private:
     superBlock_t* superBlock;
 
     void createFilesystem();
+    void computeSingleDeviceLayout(block_index_t logBlocks);
+    void computeTieredLayout(block_index_t metadataBlocks, block_index_t dataBlocks, block_index_t logBlocks);
+    void computeBlockGroupLayout(block_index_t logBlocks);
+    void initializeBlockGroups();
+    bool updateGroupDescriptors();
     void loadFilesystem();
     bool readInode(inode_index_t inodeLocation, inode_t& inode);
     bool writeInode(inode_index_t inodeLocation, inode_t& inode);
@@ -4,15 +4,149 @@
 
 #include "InodeTable.h"
 #include "cstdio"
+#include "cassert"
+#include "algorithm"
 #include "LogManager.h"
 #include "LogRecord.h"
 
 namespace fs {
 
+#ifdef NOT_KERNEL
+#define UPDATE_LOCK() std::lock_guard<std::mutex> updateLock(updateMutex)
+#else
+#define UPDATE_LOCK()
+#endif
+
 InodeTable::InodeTable(const block_index_t startBlock, const inode_index_t numBlocks, const inode_index_t size, const inode_index_t inodeRegionStart,
-                       BlockManager* blockManager): startBlock(startBlock), numBlocks(numBlocks), size(size), inodeRegionStart(inodeRegionStart),
-                                                    blockManager(blockManager)
+                       BlockManager* blockManager, const block_index_t blocksPerGroup, BitmapManager* inodeBitmap): startBlock(startBlock), numBlocks(numBlocks), size(size), inodeRegionStart(inodeRegionStart),
+                                                    blockManager(blockManager), blocksPerGroup(blocksPerGroup), inodeBitmap(inodeBitmap)
+{
+    loadTable();
+}
+
+InodeTable::InodeTable(const InodeTable* liveTable): startBlock(liveTable->startBlock), numBlocks(liveTable->numBlocks),
+    size(liveTable->size), blockManager(liveTable->blockManager), inodeRegionStart(liveTable->inodeRegionStart),
+    blocksPerGroup(liveTable->blocksPerGroup), snapshotMode(true), inodeBitmap(nullptr)
+{
+    icache.assign(ICACHE_SIZE, nullptr);
+    checkpointCache.resize(SNAPSHOT_CACHED_BLOCKS);
+}
+
+InodeTable::~InodeTable()
+{
+    for (const cachedInode* cached : icache)
+    {
+        delete cached;
+    }
+    delete openBlock;
+}
+
+void InodeTable::loadTable()
+{
+    locations.resize(static_cast<size_t>(numBlocks) * TABLE_ENTRIES_PER_BLOCK);
+    blockDirty.assign(numBlocks, false);
+    if (!blockManager->readBlocks(startBlock, numBlocks, reinterpret_cast<uint8_t*>(locations.data())))
+    {
+        printf("Could not read inode table blocks\n");
+        assert(0);
+    }
+    rebuildFreeNumbers();
+    icache.assign(ICACHE_SIZE, nullptr);
+}
+
+void InodeTable::rebuildFreeNumbers()
+{
+    const size_t wordCount = (size + 63) / 64;
+    usedNumbers.assign(wordCount, 0);
+    fullWords.assign((wordCount + 63) / 64, 0);
+    firstFreeSummary = 0;
+    // Numbers past the end of the table count as used so they are never handed out.
+    for (size_t n = size; n < wordCount * 64; n++)
+    {
+        usedNumbers[n / 64] |= 1ULL << (n % 64);
+    }
+    for (size_t w = wordCount; w < fullWords.size() * 64; w++)
+    {
+        fullWords[w / 64] |= 1ULL << (w % 64);
+    }
+    for (inode_index_t i = 0; i < size; i++)
+    {
+        if (locations[i] != INODE_NULL_VALUE)
+        {
+            usedNumbers[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    for (size_t w = 0; w < wordCount; w++)
+    {
+        if (usedNumbers[w] == UINT64_MAX)
+        {
+            fullWords[w / 64] |= 1ULL << (w % 64);
+        }
+    }
+}
+
+void InodeTable::markNumber(const inode_index_t inodeNumber, const bool used)
+{
+    const size_t w = inodeNumber / 64;
+    if (used)
+    {
+        usedNumbers[w] |= 1ULL << (inodeNumber % 64);
+        if (usedNumbers[w] == UINT64_MAX)
+        {
+            fullWords[w / 64] |= 1ULL << (w % 64);
+        }
+    }
+    else
+    {
+        usedNumbers[w] &= ~(1ULL << (inodeNumber % 64));
+        fullWords[w / 64] &= ~(1ULL << (w % 64));
+        firstFreeSummary = std::min(firstFreeSummary, w / 64);
+    }
+}
+
+bool InodeTable::flush()
+{
+    if (snapshotMode)
+    {
+        return true;
+    }
+    UPDATE_LOCK();
+    inode_index_t b = 0;
+    while (b < numBlocks)
+    {
+        if (!blockDirty[b])
+        {
+            b++;
+            continue;
+        }
+        inode_index_t run = 1;
+        while (b + run < numBlocks && blockDirty[b + run])
+        {
+            run++;
+        }
+        if (!blockManager->writeBlocks(startBlock + b, run,
+                                       reinterpret_cast<const uint8_t*>(&locations[b * TABLE_ENTRIES_PER_BLOCK])))
+        {
+            printf("Could not write inode table block\n");
+            return false;
+        }
+        for (inode_index_t i = 0; i < run; i++)
+        {
+            blockDirty[b + i] = false;
+        }
+        b += run;
+    }
+    return true;
+}
+
+block_index_t InodeTable::getInodeBlock(const inode_index_t inodeLocation) const
 {
+    if (blocksPerGroup == 0)
+    {
+        return inodeRegionStart + inodeLocation / INODES_PER_BLOCK;
+    }
+    return inodeRegionStart + inodeLocation / INODE_LOCATIONS_PER_GROUP * blocksPerGroup +
+        inodeLocation % INODE_LOCATIONS_PER_GROUP / INODES_PER_BLOCK;
 }
 
 bool InodeTable::initialize(const block_index_t startBlock, const inode_index_t numBlocks,
@@ -36,20 +170,20 @@ bool InodeTable::initialize(const block_index_t startBlock, const inode_index_t
 
 inode_index_t InodeTable::getFreeInodeNumber()
 {
-    block_t tempBlock;
-    for (inode_index_t i = 0; i < size; i++)
+    if (snapshotMode)
     {
-        if (i % TABLE_ENTRIES_PER_BLOCK == 0)
-        {
-            if (!blockManager->readBlock(startBlock + i / TABLE_ENTRIES_PER_BLOCK, tempBlock.data))
-            {
-                printf("Could not read inode table block\n");
-                return INODE_NULL_VALUE;
-            }
-        }
-        if (tempBlock.inodeTable.inodeNumbers[i % TABLE_ENTRIES_PER_BLOCK] == INODE_NULL_VALUE)
+        return INODE_NULL_VALUE;
+    }
+    UPDATE_LOCK();
+    for (; firstFreeSummary < fullWords.size(); firstFreeSummary++)
+    {
+        const uint64_t summary = fullWords[firstFreeSummary];
+        if (summary != UINT64_MAX)
         {
-            return i;
+            const size_t w = firstFreeSummary * 64 + __builtin_ctzll(~summary);
+            const auto inodeNumber = static_cast<inode_index_t>(w * 64 + __builtin_ctzll(~usedNumbers[w]));
+            markNumber(inodeNumber, true);
+            return inodeNumber;
         }
     }
     return INODE_NULL_VALUE;
@@ -62,24 +196,24 @@ bool InodeTable::setInodeLocation(inode_index_t inodeNumber, inode_index_t locat
         printf("Inode number out of bounds\n");
         return false;
     }
-    if (snapshotMode) {
-        // Update the native array in snapshot mode.
-        snapshotMapping[inodeNumber] = location;
-        return true;
-    }
-    inode_index_t blockNum = inodeNumber / TABLE_ENTRIES_PER_BLOCK;
-    inode_index_t entryNum = inodeNumber % TABLE_ENTRIES_PER_BLOCK;
-    block_t tempBlock;
-    if (!blockManager->readBlock(startBlock + blockNum, tempBlock.data))
+    if (snapshotMode)
     {
-        printf("Could not read inode table block\n");
+        printf("Snapshot inode table is read-only\n");
         return false;
     }
-    tempBlock.inodeTable.inodeNumbers[entryNum] = location;
-    if (!blockManager->writeBlock(startBlock + blockNum, tempBlock.data))
+    UPDATE_LOCK();
+    if (locations[inodeNumber] != location)
     {
-        printf("Could not write inode table block\n");
-        return false;
+        // Release: a reader that sees the new location also sees the inode written there.
+        __atomic_store_n(&locations[inodeNumber], location, __ATOMIC_RELEASE);
+        blockDirty[inodeNumber / TABLE_ENTRIES_PER_BLOCK] = true;
+    }
+    markNumber(inodeNumber, location != INODE_NULL_VALUE);
+    // Lookups check the location anyway; dropping the stale version just frees it sooner.
+    const cachedInode* cached = __atomic_load_n(&icache[inodeNumber % ICACHE_SIZE], __ATOMIC_ACQUIRE);
+    if (cached != nullptr && cached->inodeNumber == inodeNumber && cached->location != location)
+    {
+        retireCachedInode(inodeNumber, cached);
     }
     return true;
 }
@@ -91,25 +225,224 @@ inode_index_t InodeTable::getInodeLocation(inode_index_t inodeNumber)
         printf("Inode number out of bounds\n");
         return INODE_NULL_VALUE;
     }
-    if (snapshotMode) {
-        // Return from the native array.
- //       cout << "Got snapshot Inode mapping: " << inodeNumber << " to " << snapshotMapping[inodeNumber] << endl;
-        return snapshotMapping[inodeNumber];
+    if (snapshotMode)
+    {
+        UPDATE_LOCK();
+        return getSnapshotLocation(inodeNumber);
     }
-    inode_index_t blockNum = inodeNumber / TABLE_ENTRIES_PER_BLOCK;
-    inode_index_t entryNum = inodeNumber % TABLE_ENTRIES_PER_BLOCK;
-    block_t tempBlock;
-    if (!blockManager->readBlock(startBlock + blockNum, tempBlock.data))
+    return __atomic_load_n(&locations[inodeNumber], __ATOMIC_ACQUIRE);
+}
+
+bool InodeTable::inBlock(const openInodeBlock* image, const inode_index_t inodeLocation)
+{
+    return image != nullptr && inodeLocation >= image->first && inodeLocation < image->first + INODES_PER_BLOCK;
+}
+
+inode_index_t InodeTable::allocateInodeSlot(const inode_index_t goal)
+{
+    if (!inodeBitmap)
     {
-        printf("Could not read inode table block\n");
+        printf("Inode table has no inode bitmap to allocate from\n");
         return INODE_NULL_VALUE;
     }
-    return tempBlock.inodeTable.inodeNumbers[entryNum];
+    UPDATE_LOCK();
+    const bool goalInGroup = openBlock != nullptr && (goal == INODE_NULL_VALUE || blocksPerGroup == 0 ||
+        goal / INODE_LOCATIONS_PER_GROUP == openBlock->first / INODE_LOCATIONS_PER_GROUP);
+    if (goalInGroup)
+    {
+        // Slots taken by a single-slot allocation in the meantime are skipped.
+        for (; openBlockNext < openBlock->first + INODES_PER_BLOCK; openBlockNext++)
+        {
+            if (inodeBitmap->tryAllocate(openBlockNext))
+            {
+                setFreshSlot(openBlockNext, true);
+                return openBlockNext++;
+            }
+        }
+    }
+    const inode_index_t first = inodeBitmap->findFreeAligned(INODES_PER_BLOCK, goal);
+    if (first == NULL_INDEX || !inodeBitmap->tryAllocate(first))
+    {
+        // No wholly free block: fall back to a single slot.
+        const inode_index_t slot = inodeBitmap->allocate(goal);
+        if (slot != NULL_INDEX)
+        {
+            setFreshSlot(slot, true);
+        }
+        return slot;
+    }
+    // The previous block's inodes have to reach the disk before its image is dropped, since readers that miss the
+    // new image read them from there. Its unused slots stay free.
+    if (!writeOpenBlock())
+    {
+        inodeBitmap->setUnallocated(first);
+        return INODE_NULL_VALUE;
+    }
+    auto* image = new openInodeBlock{first};
+    openInodeBlock* previous = __atomic_exchange_n(&openBlock, image, __ATOMIC_ACQ_REL);
+    if (previous != nullptr)
+    {
+        epochs.retire(previous);
+    }
+    openBlockNext = first + 1;
+    setFreshSlot(first, true);
+    return first;
+}
+
+bool InodeTable::isFreshSlot(const inode_index_t inodeLocation) const
+{
+    const size_t w = inodeLocation / 64;
+    return w < freshSlots.size() && (freshSlots[w] >> (inodeLocation % 64) & 1);
+}
+
+void InodeTable::setFreshSlot(const inode_index_t inodeLocation, const bool fresh)
+{
+    const size_t w = inodeLocation / 64;
+    if (w >= freshSlots.size())
+    {
+        if (!fresh)
+        {
+            return;
+        }
+        freshSlots.resize(w + 1, 0);
+    }
+    if (fresh)
+    {
+        freshSlots[w] |= 1ULL << (inodeLocation % 64);
+    }
+    else
+    {
+        freshSlots[w] &= ~(1ULL << (inodeLocation % 64));
+    }
+}
+
+void InodeTable::releaseInodeSlot(const inode_index_t inodeLocation)
+{
+    if (inodeLocation == INODE_NULL_VALUE || !inodeBitmap)
+    {
+        return;
+    }
+    UPDATE_LOCK();
+    if (!isFreshSlot(inodeLocation))
+    {
+        return;
+    }
+    setFreshSlot(inodeLocation, false);
+    releasedSlots.push_back(inodeLocation);
+}
+
+void InodeTable::sealReleasedSlots()
+{
+    UPDATE_LOCK();
+    sealedSlots.insert(sealedSlots.end(), releasedSlots.begin(), releasedSlots.end());
+    releasedSlots.clear();
+}
+
+void InodeTable::freeSealedSlots()
+{
+    UPDATE_LOCK();
+    for (const inode_index_t slot : sealedSlots)
+    {
+        freeInodeSlot(slot);
+    }
+    sealedSlots.clear();
+}
+
+void InodeTable::freeInodeSlot(const inode_index_t inodeLocation)
+{
+    if (!inodeBitmap)
+    {
+        return;
+    }
+    // Lock-free readers may have looked up the old location and still be reading the slot.
+    epochs.retire([](void* table, const uint64_t location)
+    {
+        static_cast<InodeTable*>(table)->inodeBitmap->setUnallocated(static_cast<inode_index_t>(location));
+    }, this, inodeLocation);
+}
+
+void InodeTable::reclaimFreedSlots()
+{
+    epochs.synchronize();
+}
+
+void InodeTable::startCheckpointInterval(std::vector<inode_index_t>& locationsOut)
+{
+    UPDATE_LOCK();
+    locationsOut = locations;
+    for (const inode_index_t location : locations)
+    {
+        if (location != INODE_NULL_VALUE)
+        {
+            setFreshSlot(location, false);
+        }
+    }
+}
+
+void InodeTable::replaySlotChange(const inode_index_t oldLocation, const inode_index_t newLocation)
+{
+    if (!inodeBitmap)
+    {
+        return;
+    }
+    UPDATE_LOCK();
+    if (oldLocation != INODE_NULL_VALUE && oldLocation != newLocation && isFreshSlot(oldLocation))
+    {
+        setFreshSlot(oldLocation, false);
+        replaySuperseded.push_back(oldLocation);
+    }
+    if (newLocation != INODE_NULL_VALUE)
+    {
+        setFreshSlot(newLocation, true);
+    }
+}
+
+void InodeTable::finishReplay()
+{
+    UPDATE_LOCK();
+    // A slot that is fresh again was reused by a later record.
+    for (const inode_index_t slot : replaySuperseded)
+    {
+        if (!isFreshSlot(slot))
+        {
+            inodeBitmap->setUnallocated(slot);
+        }
+    }
+    replaySuperseded.clear();
+}
+
+bool InodeTable::flushInodes()
+{
+    UPDATE_LOCK();
+    return writeOpenBlock();
+}
+
+bool InodeTable::writeOpenBlock()
+{
+    if (!openBlockDirty)
+    {
+        return true;
+    }
+    // Every slot of the block belongs to it, so the image replaces the block without reading it first.
+    if (!blockManager->writeBlock(getInodeBlock(openBlock->first), openBlock->block.data))
+    {
+        printf("Could not write inode block\n");
+        return false;
+    }
+    openBlockDirty = false;
+    return true;
 }
 
 bool InodeTable::writeInode(inode_index_t inodeLocation, inode_t& inode)
 {
-    block_index_t inodeBlock = inodeRegionStart + inodeLocation / INODES_PER_BLOCK;
+    UPDATE_LOCK();
+    if (inBlock(openBlock, inodeLocation))
+    {
+        openBlock->block.inodeBlock.inodes[inodeLocation % INODES_PER_BLOCK] = inode;
+        openBlockDirty = true;
+        return true;
+    }
+    block_index_t inodeBlock = getInodeBlock(inodeLocation);
     block_t tempBlock;
     if (!blockManager->readBlock(inodeBlock, tempBlock.data))
     {
@@ -129,7 +462,15 @@ bool InodeTable::writeInode(inode_index_t inodeLocation, inode_t& inode)
 
 bool InodeTable::readInode(inode_index_t inodeLocation, inode_t& inode)
 {
-    block_index_t inodeBlock = inodeRegionStart + inodeLocation / INODES_PER_BLOCK;
+    // Held through the disk read too: a slot freed meanwhile could be reused and rewritten under the reader.
+    EpochManager::Guard guard(epochs);
+    const openInodeBlock* image = __atomic_load_n(&openBlock, __ATOMIC_ACQUIRE);
+    if (inBlock(image, inodeLocation))
+    {
+        inode = image->block.inodeBlock.inodes[inodeLocation % INODES_PER_BLOCK];
+        return true;
+    }
+    block_index_t inodeBlock = getInodeBlock(inodeLocation);
     block_t tempBlock;
     if (!blockManager->readBlock(inodeBlock, tempBlock.data))
     {
@@ -141,66 +482,158 @@ bool InodeTable::readInode(inode_index_t inodeLocation, inode_t& inode)
     return true;
 }
 
+bool InodeTable::readInodeByNumber(const inode_index_t inodeNumber, inode_index_t& inodeLocation, inode_t& inode)
+{
+    // One guard from loading the location to copying the inode out, so the slot can't be freed and reused in
+    // between.
+    EpochManager::Guard guard(epochs);
+    inodeLocation = getInodeLocation(inodeNumber);
+    if (inodeLocation == INODE_NULL_VALUE)
+    {
+        return false;
+    }
+    const cachedInode* cached = __atomic_load_n(&icache[inodeNumber % ICACHE_SIZE], __ATOMIC_ACQUIRE);
+    if (cached != nullptr && cached->inodeNumber == inodeNumber && cached->location == inodeLocation)
+    {
+        inode = cached->inode;
+        return true;
+    }
+    if (!readInode(inodeLocation, inode))
+    {
+        return false;
+    }
+    cacheInode(inodeNumber, inodeLocation, inode);
+    return true;
+}
+
+void InodeTable::cacheInode(const inode_index_t inodeNumber, const inode_index_t inodeLocation, const inode_t& inode)
+{
+    // A reader may cache a version that has just been superseded; lookups then miss on the location until the
+    // entry is replaced.
+    const auto* entry = new cachedInode{inodeNumber, inodeLocation, inode};
+    const cachedInode* previous = __atomic_exchange_n(&icache[inodeNumber % ICACHE_SIZE], entry, __ATOMIC_ACQ_REL);
+    if (previous != nullptr)
+    {
+        epochs.retire(const_cast<cachedInode*>(previous));
+    }
+}
+
+void InodeTable::retireCachedInode(const inode_index_t inodeNumber, const cachedInode* expected)
+{
+    if (__atomic_compare_exchange_n(&icache[inodeNumber % ICACHE_SIZE], &expected, nullptr, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        epochs.retire(const_cast<cachedInode*>(expected));
+    }
+}
+
 bool InodeTable::readInodeBlock(inode_index_t blockIndex, inode_index_t* outBuffer)
 {
     // Ensure blockIndex is within the number of inode table blocks.
-    if (blockIndex >= numBlocks) {
-        printf("readInodeBlock: block index %d is out of range.\n", blockIndex);
+    if (snapshotMode) {
+        printf("readInodeBlock: not available on a snapshot table.\n");
         return false;
     }
-    block_t tempBlock;
-    // Read the block from disk. The inode table blocks start at startBlock.
-    if (!blockManager->readBlock(startBlock + blockIndex, tempBlock.data)) {
-        printf("readInodeBlock: could not read inode table block %d\n", (startBlock + blockIndex));
+    if (blockIndex >= numBlocks) {
+        printf("readInodeBlock: block index %d is out of range.\n", blockIndex);
         return false;
     }
-    // Copy the entire array of inodeNumbers from the block into outBuffer.
-    memcpy(outBuffer, tempBlock.inodeTable.inodeNumbers, TABLE_ENTRIES_PER_BLOCK * sizeof(inode_index_t));
+    UPDATE_LOCK();
+    // Copy the block's worth of entries from the in-memory table into outBuffer.
+    memcpy(outBuffer, &locations[blockIndex * TABLE_ENTRIES_PER_BLOCK], TABLE_ENTRIES_PER_BLOCK * sizeof(inode_index_t));
     return true;
 }
 
 InodeTable* InodeTable::createSnapshotFromCheckpoint(block_index_t checkpointBlockIndex, InodeTable* liveTable)
 {
-    // Create a new InodeTable instance using the live table's parameters.
-    auto* snapshot = new InodeTable(liveTable->startBlock, liveTable->numBlocks, liveTable->size,
-                                           liveTable->inodeRegionStart, liveTable->blockManager);
-    // Set snapshot mode and allocate the native array.
-    snapshot->snapshotMode = true;
-    snapshot->snapshotMapping = new inode_index_t[liveTable->size];
-    for (inode_index_t i = 0; i < liveTable->size; i++) {
-        snapshot->snapshotMapping[i] = INODE_NULL_VALUE;
-    }
+    // Create an empty snapshot InodeTable using the live table's parameters.
+    auto* snapshot = new InodeTable(liveTable);
+    snapshot->nextUnindexed = checkpointBlockIndex;
 
-    inode_index_t totalInodes = liveTable->size;
+    // Reading the head block checks that the chain is there and indexes its first range.
+    const cachedCheckpointBlock* head = snapshot->loadCheckpointBlock(checkpointBlockIndex);
+    if (head == nullptr)
+    {
+        delete snapshot;
+        return nullptr;
+    }
+    return snapshot;
+}
 
-    // Traverse the checkpoint chain to set the mapping entries.
+const InodeTable::cachedCheckpointBlock* InodeTable::loadCheckpointBlock(const block_index_t block)
+{
     checkpointBlock_t checkpoint;
-    block_index_t currentCp = checkpointBlockIndex;
-    while (true) {
-        if (!liveTable->blockManager->readBlock(currentCp, reinterpret_cast<uint8_t*>(&checkpoint))) {
-            printf("Snapshot: Failed to read checkpoint block at %d\n", currentCp);
-            delete snapshot;
-            return nullptr;
-        }
-        if (checkpoint.magic != CHECKPOINT_MAGIC) {
-            printf("Snapshot: Invalid checkpoint magic at %d\n", currentCp);
-            delete snapshot;
-            return nullptr;
-        }
-        for (uint32_t i = 0; i < checkpoint.numEntries; i++) {
-            inode_index_t idx = checkpoint.entries[i].inodeIndex;
-            inode_index_t cpLocation = checkpoint.entries[i].inodeLocation;
-            if (idx < totalInodes) {
-//                cout << "Setting snapshot mapping for inode index " << idx << " to location " << cpLocation << endl;
-                snapshot->snapshotMapping[idx] = cpLocation;
-            }
+    if (!blockManager->readBlock(block, reinterpret_cast<uint8_t*>(&checkpoint)))
+    {
+        printf("Snapshot: Failed to read checkpoint block at %d\n", block);
+        return nullptr;
+    }
+    if (checkpoint.magic != CHECKPOINT_MAGIC || checkpoint.numEntries > NUM_CHECKPOINTENTRIES_PER_CHECKPOINT)
+    {
+        printf("Snapshot: Invalid checkpoint magic at %d\n", block);
+        return nullptr;
+    }
+    if (block == nextUnindexed)
+    {
+        if (checkpoint.numEntries > 0)
+        {
+            checkpointIndex.push_back({block, checkpoint.entries[0].inodeIndex,
+                                       checkpoint.entries[checkpoint.numEntries - 1].inodeIndex});
+        }
+        nextUnindexed = checkpoint.nextCheckpointBlock;
+    }
+    cachedCheckpointBlock* victim = &checkpointCache[0];
+    for (auto& cached : checkpointCache)
+    {
+        if (cached.lastUse < victim->lastUse)
+        {
+            victim = &cached;
         }
-        if (checkpoint.nextCheckpointBlock == NULL_INDEX)
-            break;
-        currentCp = checkpoint.nextCheckpointBlock;
     }
+    victim->block = block;
+    victim->lastUse = ++checkpointCacheClock;
+    victim->entries.assign(checkpoint.entries, checkpoint.entries + checkpoint.numEntries);
+    return victim;
+}
 
-    return snapshot;
+inode_index_t InodeTable::getSnapshotLocation(const inode_index_t inodeNumber)
+{
+    // Extend the index until it covers inodeNumber or the chain ends.
+    while ((checkpointIndex.empty() || checkpointIndex.back().lastInode < inodeNumber) && nextUnindexed != NULL_INDEX)
+    {
+        if (loadCheckpointBlock(nextUnindexed) == nullptr)
+        {
+            return INODE_NULL_VALUE;
+        }
+    }
+    const auto range = std::lower_bound(checkpointIndex.begin(), checkpointIndex.end(), inodeNumber,
+                                        [](const checkpointIndexEntry& e, const inode_index_t n) { return e.lastInode < n; });
+    if (range == checkpointIndex.end() || range->firstInode > inodeNumber)
+    {
+        return INODE_NULL_VALUE;
+    }
+
+    const cachedCheckpointBlock* entries = nullptr;
+    for (auto& cached : checkpointCache)
+    {
+        if (cached.block == range->block)
+        {
+            cached.lastUse = ++checkpointCacheClock;
+            entries = &cached;
+            break;
+        }
+    }
+    if (entries == nullptr && (entries = loadCheckpointBlock(range->block)) == nullptr)
+    {
+        return INODE_NULL_VALUE;
+    }
+    const auto entry = std::lower_bound(entries->entries.begin(), entries->entries.end(), inodeNumber,
+                                        [](const checkpoint_entry_t& e, const inode_index_t n) { return e.inodeIndex < n; });
+    if (entry == entries->entries.end() || entry->inodeIndex != inodeNumber)
+    {
+        return INODE_NULL_VALUE;
+    }
+    return entry->inodeLocation;
 }
 
 } // namespace fs
\ No newline at end of file
@@ -7,46 +7,197 @@
 #include "cstring"
 #include "Block.h"
 #include "../interface/BlockManager.h"
+#include "BitmapManager.h"
+#include "EpochManager.h"
+#include "vector"
+#ifdef NOT_KERNEL
+#include "mutex"
+#endif
 
 namespace fs {
+// The inode number -> inode location map is loaded into memory when the table is constructed and is only read
+// and updated there. Updates mark their table block dirty; the dirty blocks are written back by flush(), which the
+// LogManager calls at each checkpoint. Between checkpoints the on-disk table may be stale, so mounting replays
+// the log from the last checkpoint on top of it.
+//
+// Inode slots are written log-structured: allocateInodeSlot hands out consecutive slots of an inode block that was
+// wholly free when it was opened, and writeInode only copies inodes for that block into an in-memory image of it.
+// flushInodes() writes the image with a single block write and no read; the LogManager calls it ahead of every log
+// entry, so a batch of inode updates costs one inode-region write.
+//
+// Lookups take no locks. An inode slot is never rewritten while an inode number maps to it, so only the number ->
+// location map changes: its entries are stored with release semantics after the inode they point at is written,
+// and cached inodes and the open block image are published by swapping pointers to immutable or append-only
+// objects. What a swap replaces is retired through the table's EpochManager and freed once no reader can still hold
+// it. Updates are serialized among themselves by updateMutex.
 class InodeTable
 {
 public:
     // InodeTable(block_index_t startBlock, inode_index_t numBlocks, inode_index_t size, BlockManager* blockManager);
+    // With block groups (blocksPerGroup != 0), inodeRegionStart is the first group's inode region and each
+    // following group's region sits blocksPerGroup blocks further on.
     InodeTable(block_index_t startBlock, inode_index_t numBlocks, inode_index_t size, inode_index_t inodeRegionStart,
-               BlockManager* blockManager);
+               BlockManager* blockManager, block_index_t blocksPerGroup = 0, BitmapManager* inodeBitmap = nullptr);
+    ~InodeTable();
     static bool initialize(block_index_t startBlock, inode_index_t numBlocks, BlockManager* blockManager);
+    // Lowest inode number without a location, found through a two-level bitmap rather than a table scan. The
+    // number is reserved from then on, so it is not handed out twice before its location is set; setting its
+    // location to INODE_NULL_VALUE releases it.
     inode_index_t getFreeInodeNumber();
     bool setInodeLocation(block_index_t inodeNumber, inode_index_t location);
+    // Served from memory without locking; never touches the disk. Snapshot tables may read checkpoint blocks.
     inode_index_t getInodeLocation(block_index_t inodeNumber);
+    // Allocates an inode slot for a new inode version. Slots come from the open inode block while it has room
+    // (and, with block groups, is in goal's group); otherwise a wholly free block near goal is opened. If there is
+    // none a single slot is allocated, which writeInode then updates in place (unless it is in the open block).
+    inode_index_t allocateInodeSlot(inode_index_t goal = INODE_NULL_VALUE);
+    // Writes the open inode block if it holds inodes that are not on disk yet.
+    bool flushInodes();
+    // Called once the change that stopped inodeLocation from holding an inode's current version has been logged.
+    // A slot allocated since the last checkpoint is referenced by no checkpoint, so it is freed once that record is
+    // on disk and no reader can still be using the slot. An older slot stays allocated: a retained checkpoint maps
+    // to it until the LogManager drops that checkpoint.
+    void releaseInodeSlot(inode_index_t inodeLocation);
+    // Frees a slot nothing refers to any more, once no lock-free reader can still be using it.
+    void freeInodeSlot(inode_index_t inodeLocation);
+    // Waits for the readers that could still be using freed slots and returns the slots to the inode bitmap, so a
+    // bitmap flush that follows includes them. Must not be called from within a reader.
+    void reclaimFreedSlots();
+    // Called by the LogManager as it takes records into a commit: the slots released so far were superseded by
+    // records in this commit or an earlier one. freeSealedSlots frees them once the commit is on disk.
+    void sealReleasedSlots();
+    void freeSealedSlots();
+    // Copies the number -> location map for a checkpoint. The slots it maps to are referenced by the checkpoint
+    // from then on and stop being fresh, in the same critical section, so no release can free one of them.
+    // Fresh slots outside the copy (superseded but not yet released, or not yet published) stay fresh.
+    void startCheckpointInterval(std::vector<inode_index_t>& locationsOut);
+    // Log replay moved an inode from oldLocation to newLocation (either may be INODE_NULL_VALUE). Slots allocated
+    // and superseded since the checkpoint are freed by finishReplay unless a later record reused them; the frees
+    // may not have reached the disk before the crash.
+    void replaySlotChange(inode_index_t oldLocation, inode_index_t newLocation);
+    void finishReplay();
     bool writeInode(inode_index_t inodeLocation, inode_t& inode);
     bool readInode(inode_index_t inodeLocation, inode_t& inode);
+    // Looks up the inode's current location and reads it, going through the inode cache. Fails if the inode
+    // number has no location.
+    bool readInodeByNumber(inode_index_t inodeNumber, inode_index_t& inodeLocation, inode_t& inode);
+    // Records the inode just written at inodeLocation as the cached copy for inodeNumber.
+    void cacheInode(inode_index_t inodeNumber, inode_index_t inodeLocation, const inode_t& inode);
+    // Block holding the inode slot at inodeLocation.
+    block_index_t getInodeBlock(inode_index_t inodeLocation) const;
 
     // outBuffer must be able to hold TABLE_ENTRIES_PER_BLOCK entries.
     bool readInodeBlock(inode_index_t blockIndex, inode_index_t* outBuffer);
 
-    // Create a snapshot copy of the inode table state from a checkpoint chain.
+    // Writes the table blocks changed since the last flush back to disk, batching adjacent blocks into one write.
+    // Does nothing for a snapshot table.
+    bool flush();
+
+    // Create a read-only snapshot of the inode table state from a checkpoint chain.
     // checkpointBlockIndex is the block index of the head checkpoint block.
-    // Returns a new InodeTable instance in snapshot mode.
+    // Returns a new InodeTable instance in snapshot mode. Only the head block is read here; the rest of the chain
+    // is read as lookups reach it, so a snapshot costs memory in proportion to what is looked up, not to the
+    // inode count.
     static InodeTable* createSnapshotFromCheckpoint(block_index_t checkpointBlockIndex, InodeTable* liveTable);
 
-    ~InodeTable() {
-        if (snapshotMode && snapshotMapping != nullptr) {
-            delete[] snapshotMapping;
-            snapshotMapping = nullptr;
-        }
-    }
-
 
 private:
+    static constexpr inode_index_t ICACHE_SIZE = 256;
+
+    // An inode slot is never rewritten while an inode number maps to it, so a cached copy is valid as long as its
+    // location is still the one in the table. Entries are never modified once published; caching a newer version
+    // swaps in a new entry.
+    struct cachedInode
+    {
+        inode_index_t inodeNumber = INODE_NULL_VALUE;
+        inode_index_t location = INODE_NULL_VALUE;
+        inode_t inode;
+    };
+
+    static constexpr size_t SNAPSHOT_CACHED_BLOCKS = 4;
+
+    // Inode numbers covered by one block of a checkpoint chain. createCheckpoint writes entries in inode number
+    // order, so the blocks partition the inode numbers into ascending ranges.
+    struct checkpointIndexEntry
+    {
+        block_index_t block;
+        inode_index_t firstInode;
+        inode_index_t lastInode;
+    };
+
+    struct cachedCheckpointBlock
+    {
+        block_index_t block = BLOCK_NULL_VALUE;
+        uint64_t lastUse = 0;
+        std::vector<checkpoint_entry_t> entries;  // sorted by inodeIndex
+    };
+
+    // Snapshot table with the live table's geometry and no entries; nothing is read from disk.
+    explicit InodeTable(const InodeTable* liveTable);
+
+    inode_index_t getSnapshotLocation(inode_index_t inodeNumber);
+    // Reads checkpoint block `block`, adds it to the cache (evicting the least recently used one) and, if it is the
+    // next unindexed block of the chain, to the index.
+    const cachedCheckpointBlock* loadCheckpointBlock(block_index_t block);
+
+    void loadTable();
+    // Rebuilds the inode number bitmaps from locations.
+    void rebuildFreeNumbers();
+    void markNumber(inode_index_t inodeNumber, bool used);
+    bool isFreshSlot(inode_index_t inodeLocation) const;
+    void setFreshSlot(inode_index_t inodeLocation, bool fresh);
+    // Image of the inode block being filled. Slots are only written before their location is published, and the
+    // image is replaced (not reused) when another block is opened, so readers can copy inodes out of it.
+    struct openInodeBlock
+    {
+        inode_index_t first;  // first slot of the block
+        block_t block{};
+    };
+
+    static bool inBlock(const openInodeBlock* image, inode_index_t inodeLocation);
+    // flushInodes without taking updateMutex.
+    bool writeOpenBlock();
+    void retireCachedInode(inode_index_t inodeNumber, const cachedInode* expected);
+
     block_index_t startBlock;
     inode_index_t numBlocks;
     inode_index_t size;
     BlockManager* blockManager;
     uint32_t inodeRegionStart;
+    block_index_t blocksPerGroup;
 
     bool snapshotMode = false;
-    inode_index_t* snapshotMapping;  // Native array for snapshot mappings
+    std::vector<inode_index_t> locations;  // numBlocks * TABLE_ENTRIES_PER_BLOCK entries, laid out as on disk
+                                           // (empty for a snapshot)
+
+    std::vector<checkpointIndexEntry> checkpointIndex;   // chain blocks read so far, in chain order
+    block_index_t nextUnindexed = NULL_INDEX;      // next chain block to index, NULL once it is complete
+    std::vector<cachedCheckpointBlock> checkpointCache;  // SNAPSHOT_CACHED_BLOCKS entries
+    uint64_t checkpointCacheClock = 0;
+    std::vector<bool> blockDirty;          // table blocks modified since the last flush
+
+    std::vector<uint64_t> usedNumbers;     // bit per inode number, set while it has a location or is reserved
+    std::vector<uint64_t> fullWords;       // bit per usedNumbers word, set while that word has no clear bit
+    size_t firstFreeSummary = 0;           // fullWords before this index are all full
+
+    std::vector<const cachedInode*> icache;  // direct-mapped on inodeNumber % ICACHE_SIZE, swapped atomically
+
+    BitmapManager* inodeBitmap;
+    // Slots of the open block are claimed in the inode bitmap one at a time as they are handed out, so the bitmap
+    // stays exact; whichever way a slot in it was allocated, its inode is written through openBlock.
+    openInodeBlock* openBlock = nullptr;              // swapped atomically, null until the first block is opened
+    inode_index_t openBlockNext = INODE_NULL_VALUE;   // next slot of it to hand out
+    bool openBlockDirty = false;                      // openBlock has inodes not yet written
+
+    std::vector<uint64_t> freshSlots;                 // bit per slot allocated since the last checkpoint
+    std::vector<inode_index_t> replaySuperseded;      // fresh slots superseded during log replay
+    std::vector<inode_index_t> releasedSlots;         // released, superseding record maybe not committed yet
+    std::vector<inode_index_t> sealedSlots;           // released, superseding record in a commit being written
+
+    EpochManager epochs;
+#ifdef NOT_KERNEL
+    std::mutex updateMutex;  // serializes updates, and snapshot lookups (they fill the chain index and block cache)
+#endif
 };
 
 } // namespace fs
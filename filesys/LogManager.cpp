@@ -1,123 +1,494 @@
 #include "LogManager.h"
 
 #include "cstdio"
+#include "algorithm"
+#include "../interface/IoContext.h"
 // Assume that klog is a kernel logging function: void klog(const char *fmt, ...);
 
 // extern "C" void klog(const char *fmt, ...); // Prototype for kernel logging.
 
 namespace fs {
 
-LogManager::LogManager(BlockManager *blockManager, BitmapManager *blockBitmap, InodeTable *inode_table,
-                       uint32_t startBlock, uint32_t numBlocks, uint64_t latestSystemSeq)
-    : globalSequence(latestSystemSeq),
+// Fletcher-16 over the record with its checksum field taken as zero. A record only counts as written if its
+// checksum matches, so a torn or stale log block is not taken for part of the log.
+static uint16_t recordChecksum(const logRecord_t &record) {
+    logRecord_t copy = record;
+    copy.checksum = 0;
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&copy);
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for (size_t i = 0; i < sizeof(copy); i++) {
+        sum1 = (sum1 + bytes[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return static_cast<uint16_t>(sum2 << 8 | sum1);
+}
+
+static bool recordValid(const logRecord_t &record, uint64_t sequenceNumber) {
+    return record.magic == RECORD_MAGIC && record.sequenceNumber == sequenceNumber &&
+           record.checksum == recordChecksum(record);
+}
+
+LogManager::LogManager(BlockManager *blockManager, BitmapManager *blockBitmap, BitmapManager *inodeBitmap,
+                       InodeTable *inode_table, superBlock_t *superBlock, BlockManager *logDevice,
+                       uint32_t commitIntervalMs, const CheckpointPolicy &checkpointPolicy)
+    : globalSequence(superBlock->systemStateSeqNum),
       blockManager(blockManager),
+      logDevice(logDevice ? logDevice : blockManager),
       inodeTable(inode_table),
       blockBitmap(blockBitmap),
-      logStartBlock(startBlock),
-      logNumBlocks(numBlocks) {
-    // Find the latest logrecord to see if it matches the system state
-    // If it doesn't, replay the log from the last checkpoint
-    // If it does, continue logging operations
-
-    printf("Initialize logmanager: latest system log sequence is: %d\n", latestSystemSeq);
-    block_index_t latestLogBlock = startBlock + latestSystemSeq / NUM_LOGRECORDS_PER_LOGENTRY;
-    int32_t latestLogOffset = latestSystemSeq % NUM_LOGRECORDS_PER_LOGENTRY;
+      inodeBitmap(inodeBitmap),
+      superBlock(superBlock),
+      logStartBlock(superBlock->logAreaStart),
+      logNumBlocks(superBlock->logAreaSize),
+      checkpointPolicy(checkpointPolicy)
+#ifdef NOT_KERNEL
+      , commitIntervalMs(commitIntervalMs),
+      sealedSequence(globalSequence),
+      durableSequence(globalSequence)
+#endif
+{
+    // Find the latest logrecord. If there is none this is a new filesystem, otherwise the on-disk inode table
+    // only reflects the last checkpoint and the log from there on has to be replayed on top of it.
+    // The superblock's sequence number is only written at checkpoints and unmount, so the log usually goes on past
+    // it; the end is found by reading forward until a record is missing or fails its checksum.
+
+    const uint64_t start = superBlock->systemStateSeqNum;
+    printf("Initialize logmanager: log sequence as of the superblock is: %llu\n", static_cast<unsigned long long>(start));
     logEntry_t tempBlock;
-    if (!blockManager->readBlock(latestLogBlock, reinterpret_cast<uint8_t *>(&tempBlock))) {
+    if (!this->logDevice->readBlock(logBlockFor(start), reinterpret_cast<uint8_t *>(&tempBlock))) {
         printf("Could not read latest log block\n");
         return;
     }
-    if (tempBlock.records[latestLogOffset + 1].magic == RECORD_MAGIC) {
-        printf("System is not caught up to the latest log record\n");
-        //TODO check to make sure system state is consistent, then replay future log entries
-        recover();
-    } else if (tempBlock.records[latestLogOffset].sequenceNumber == latestSystemSeq) {
-//        cout << "latest system log sequence is: " << globalSequence << endl;
-        printf("System is caught up to the latest log record\n");
-        currentLogEntry = tempBlock;
-        if (globalSequence == 0) {
-            // New filesytem, need to create first checkpoint
-            if (!createCheckpoint()) {
-                printf("Failed to create initial checkpoint\n");
-            }
+    const logRecord_t &first = tempBlock.records[start % NUM_LOGRECORDS_PER_LOGENTRY];
+    if (first.magic != RECORD_MAGIC) {
+        // New filesytem, need to create first checkpoint
+        memset(&currentLogEntry, 0, sizeof(currentLogEntry));
+        if (!createCheckpoint()) {
+            printf("Failed to create initial checkpoint\n");
+        }
+    } else if (recordValid(first, start)) {
+        const uint64_t latest = findLogTail(start, tempBlock);
+        printf("Latest log record is %llu\n", static_cast<unsigned long long>(latest));
+        globalSequence = latest + 1;
+#ifdef NOT_KERNEL
+        sealedSequence = durableSequence = globalSequence;
+#endif
+        if (!recover()) {
+            printf("Failed to replay the log\n");
         }
+        currentLogEntry = tempBlock;
     } else {
-        printf("Superblock latest system state not consistent with log state: %d\n", tempBlock.records[latestLogOffset].sequenceNumber);
+        printf("Superblock latest system state not consistent with log state: %llu\n",
+               static_cast<unsigned long long>(first.sequenceNumber));
     }
+#ifdef NOT_KERNEL
+    if (commitIntervalMs != 0) {
+        commitThread = std::thread(&LogManager::commitLoop, this);
+    }
+    lastCheckpointAt = clock::now();
+    if (checkpointPolicy.logFillPercent != 0 || checkpointPolicy.replayRecords != 0 ||
+        checkpointPolicy.intervalMs != 0) {
+        checkpointThread = std::thread(&LogManager::checkpointLoop, this);
+    }
+#endif
 }
 
-bool LogManager::logOperation(LogOpType opType, LogRecordPayload *payload) {
-    // logLock.lock();
+uint64_t LogManager::findLogTail(uint64_t start, logEntry_t &entry) {
+    uint64_t latest = start;
+    logEntry_t block = entry;
+    // A block that has not been reused since the log last wrapped holds records one lap older, whose sequence
+    // numbers don't match; the scan can still go at most once around the ring.
+    for (uint64_t seq = start + 1; seq / NUM_LOGRECORDS_PER_LOGENTRY - start / NUM_LOGRECORDS_PER_LOGENTRY < logNumBlocks;
+         seq++) {
+        if (seq % NUM_LOGRECORDS_PER_LOGENTRY == 0 &&
+            !logDevice->readBlock(logBlockFor(seq), reinterpret_cast<uint8_t *>(&block))) {
+            printf("Could not read log block for record %llu\n", static_cast<unsigned long long>(seq));
+            break;
+        }
+        if (!recordValid(block.records[seq % NUM_LOGRECORDS_PER_LOGENTRY], seq)) {
+            break;
+        }
+        latest = seq;
+        if (seq % NUM_LOGRECORDS_PER_LOGENTRY == 0) {
+            // The entry holding the latest record becomes the current one again.
+            entry = block;
+        }
+    }
+    return latest;
+}
+
+LogManager::~LogManager() {
+#ifdef NOT_KERNEL
+    stopThreads();
+    commit();
+#endif
+}
+
+bool LogManager::hasRoom(uint64_t sequenceNumber, bool forCheckpoint) const {
+    // The last block is kept for the checkpoint record that moves the tail, so a full log can always be freed.
+    const uint64_t entries = sequenceNumber / NUM_LOGRECORDS_PER_LOGENTRY - logTail / NUM_LOGRECORDS_PER_LOGENTRY + 1;
+    return entries <= (forCheckpoint ? logNumBlocks : logNumBlocks - 1);
+}
+
+bool LogManager::logOperation(LogOpType opType, LogRecordPayload *payload, bool durable) {
+    const bool forCheckpoint = opType == LogOpType::LOG_UPDATE_CHECKPOINT;
+#ifdef NOT_KERNEL
+    std::unique_lock<std::mutex> lock(logMutex);
+    while (true) {
+        if (!hasRoom(globalSequence, forCheckpoint)) {
+            // The log wraps onto blocks the latest checkpoint no longer needs; a checkpoint frees the rest.
+            if (forCheckpoint) {
+                printf("Log is full\n");
+                return false;
+            }
+            if (checkpointing) {
+                logCondition.wait(lock);
+                continue;
+            }
+            lock.unlock();
+            const bool created = createCheckpoint();
+            lock.lock();
+            if (!created) {
+                return false;
+            }
+            continue;
+        }
+        // A record in slot 0 starts a new log entry over the previous one, which has to be copied into a commit
+        // first.
+        if (globalSequence % NUM_LOGRECORDS_PER_LOGENTRY == 0 && sealedSequence < globalSequence) {
+            if (!commitLocked(lock)) {
+                return false;
+            }
+            continue;
+        }
+        break;
+    }
+#else
+    if (!hasRoom(globalSequence, forCheckpoint) && (forCheckpoint || !createCheckpoint())) {
+        printf("Log is full\n");
+        return false;
+    }
+#endif
     // Create a new log record
     logRecord_t record;
     record.sequenceNumber = globalSequence++;
     record.magic = RECORD_MAGIC;
     record.opType = opType;
     record.payload = *payload;
+    record.checksum = 0;
+    record.checksum = recordChecksum(record);
 
     //cout<<"Logging operation with sequence number: "<<record.sequenceNumber<<endl;
 
 
-    if (currentLogEntry.numRecords < NUM_LOGRECORDS_PER_LOGENTRY) {
-        // Add record to current log entry and update numRecords.
-        currentLogEntry.records[currentLogEntry.numRecords++] = record;
-    } else {
-        // Start a new log entry and add the record.
+    // Record n lives in log entry n / NUM_LOGRECORDS_PER_LOGENTRY at slot n % NUM_LOGRECORDS_PER_LOGENTRY, and
+    // entries go round the log area (see logBlockFor), which is where recovery looks for it.
+    const uint16_t slot = record.sequenceNumber % NUM_LOGRECORDS_PER_LOGENTRY;
+    if (slot == 0) {
+        // Start a new log entry.
         memset(&currentLogEntry, 0, sizeof(currentLogEntry));
         currentLogEntry.magic = ENTRY_MAGIC;
-        currentLogEntry.numRecords = 0;
-        currentLogEntry.records[currentLogEntry.numRecords++] = record;
+    }
+    currentLogEntry.records[slot] = record;
+    currentLogEntry.numRecords = slot + 1;
+    // The inode map is updated along with the log, so a checkpoint, which takes its sequence number and copies the
+    // map under logMutex, holds exactly the changes of the records before it.
+    if (!applyToInodeMap(record)) {
+        return false;
     }
 
-    // write back to disk
-    block_index_t index = logStartBlock + globalSequence / NUM_LOGRECORDS_PER_LOGENTRY;
-    if (!blockManager->writeBlock(index, reinterpret_cast<uint8_t *>(&currentLogEntry))) {
-        printf("Could not write log entry to disk\n");
-        // logLock.unlock();
+#ifdef NOT_KERNEL
+    loggedAt[slot] = clock::now();
+    if (!forCheckpoint && !checkpointing && checkpointDue()) {
+        checkpointCondition.notify_one();
+    }
+    if (!durable && commitIntervalMs != 0 && slot + 1 < NUM_LOGRECORDS_PER_LOGENTRY) {
+        if (record.sequenceNumber == sealedSequence) {
+            // First record of a new group: the commit thread starts timing it.
+            logCondition.notify_all();
+        }
+        return true;
+    }
+    while (durableSequence <= record.sequenceNumber) {
+        if (!commitLocked(lock)) {
+            return false;
+        }
+    }
+    return true;
+#else
+    inodeTable->sealReleasedSlots();
+    if (!writeCommit(currentLogEntry, globalSequence)) {
         return false;
     }
+    inodeTable->freeSealedSlots();
+    stats.records++;
+    stats.commits++;
+    if (!forCheckpoint && !checkpointing && checkpointDue() && !createCheckpoint()) {
+        printf("Could not create checkpoint\n");
+    }
+    return true;
+#endif
+}
 
-    //update global sequence in superblock
-    block_t temp;
-    if (!blockManager->readBlock(0, (uint8_t *) &temp)) {
-        printf("Failed to read superblock\n");
-        // logLock.unlock();
+bool LogManager::applyToInodeMap(const logRecord_t &record) {
+    switch (record.opType) {
+        case LogOpType::LOG_OP_INODE_ADD:
+            if (!inodeTable->setInodeLocation(record.payload.inodeAdd.inodeIndex, record.payload.inodeAdd.inodeLocation)) {
+                printf("Could not set location of new inode %d\n", record.payload.inodeAdd.inodeIndex);
+                return false;
+            }
+            return true;
+        case LogOpType::LOG_OP_INODE_UPDATE:
+            if (!inodeTable->setInodeLocation(record.payload.inodeUpdate.inodeIndex,
+                                              record.payload.inodeUpdate.inodeLocation)) {
+                printf("Could not set location of inode %d\n", record.payload.inodeUpdate.inodeIndex);
+                return false;
+            }
+            return true;
+        case LogOpType::LOG_OP_INODE_DELETE:
+            if (!inodeTable->setInodeLocation(record.payload.inodeDelete.inodeIndex, INODE_NULL_VALUE)) {
+                printf("Could not remove inode %d\n", record.payload.inodeDelete.inodeIndex);
+                return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+bool LogManager::checkpointDue() const {
+    // The record at logTail is the last checkpoint's own; a checkpoint is only due for records logged after it.
+    if (globalSequence <= logTail + 1) {
         return false;
     }
-    // Subtract 1 since global sequence is post incremented
-    temp.superBlock.systemStateSeqNum = globalSequence - 1;
-    if (!blockManager->writeBlock(0, (uint8_t *) &temp)) {
-        printf("Could not write superblock\n");
-        // logLock.unlock();
+    if (checkpointPolicy.replayRecords != 0 && globalSequence - logTail - 1 >= checkpointPolicy.replayRecords) {
+        return true;
+    }
+    const uint64_t entries = (globalSequence - 1) / NUM_LOGRECORDS_PER_LOGENTRY - logTail / NUM_LOGRECORDS_PER_LOGENTRY + 1;
+    return checkpointPolicy.logFillPercent != 0 && entries * 100 >= uint64_t{checkpointPolicy.logFillPercent} * logNumBlocks;
+}
+
+bool LogManager::writeCommit(const logEntry_t &entry, uint64_t end) {
+    // Allocations and inode versions made since the last entry must be durable before a record that refers to them.
+    if (!flushMetadata()) {
+        printf("Could not write bitmaps and inodes before log entry\n");
+        return false;
+    }
+
+    // write back to disk
+    block_index_t index = logBlockFor(end - 1);
+    if (!logDevice->writeBlock(index, reinterpret_cast<const uint8_t *>(&entry))) {
+        printf("Could not write log entry to disk\n");
         return false;
     }
+    // The superblock is left alone: mount finds the end of the log from the records' checksums.
+    return true;
+}
 
-    // logLock.unlock();
+bool LogManager::commit() {
+#ifdef NOT_KERNEL
+    std::unique_lock<std::mutex> lock(logMutex);
+    const uint64_t end = globalSequence;
+    while (durableSequence < end) {
+        if (!commitLocked(lock)) {
+            return false;
+        }
+    }
+#endif
     return true;
 }
 
+LogManager::CommitStats LogManager::getCommitStats() const {
+#ifdef NOT_KERNEL
+    std::lock_guard<std::mutex> lock(logMutex);
+#endif
+    return stats;
+}
+
+#ifdef NOT_KERNEL
+bool LogManager::commitLocked(std::unique_lock<std::mutex> &lock) {
+    while (committing) {
+        logCondition.wait(lock);
+    }
+    const uint64_t begin = durableSequence;
+    const uint64_t end = globalSequence;
+    if (begin >= end) {
+        return true;
+    }
+    // Everything from durableSequence on is in the current entry: a new entry is only started once the previous
+    // one is sealed, and a failed commit unseals what it took.
+    committing = true;
+    const logEntry_t entry = currentLogEntry;
+    clock::time_point logged[NUM_LOGRECORDS_PER_LOGENTRY];
+    std::copy(loggedAt, loggedAt + NUM_LOGRECORDS_PER_LOGENTRY, logged);
+    sealedSequence = end;
+    // Inode slots given up before these records were logged can be reused once the records are on disk.
+    inodeTable->sealReleasedSlots();
+    logCondition.notify_all();
+    lock.unlock();
+
+    const bool ok = writeCommit(entry, end);
+    const clock::time_point now = clock::now();
+
+    lock.lock();
+    committing = false;
+    if (ok) {
+        durableSequence = end;
+        stats.records += end - begin;
+        stats.commits++;
+        for (uint64_t seq = begin; seq < end; seq++) {
+            const auto latency = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - logged[seq % NUM_LOGRECORDS_PER_LOGENTRY]).count());
+            stats.totalLatencyNs += latency;
+            stats.maxLatencyNs = std::max(stats.maxLatencyNs, latency);
+        }
+        inodeTable->freeSealedSlots();
+    } else {
+        sealedSequence = durableSequence;
+    }
+    logCondition.notify_all();
+    return ok;
+}
+
+void LogManager::checkpointLoop() {
+    const auto interval = std::chrono::milliseconds(checkpointPolicy.intervalMs);
+    std::unique_lock<std::mutex> lock(logMutex);
+    while (!stopping) {
+        if (checkpointing) {
+            checkpointCondition.wait(lock);
+            continue;
+        }
+        if (!checkpointDue()) {
+            if (checkpointPolicy.intervalMs == 0) {
+                checkpointCondition.wait(lock);
+                continue;
+            }
+            const clock::time_point due = lastCheckpointAt + interval;
+            if (clock::now() < due) {
+                checkpointCondition.wait_until(lock, due);
+                continue;
+            }
+            if (globalSequence <= logTail + 1) {
+                // Nothing has been logged since the last checkpoint's own record.
+                lastCheckpointAt = clock::now();
+                continue;
+            }
+        }
+        lock.unlock();
+        const bool created = createCheckpoint();
+        lock.lock();
+        if (!created) {
+            checkpointCondition.wait_for(lock, std::chrono::seconds(1));
+        }
+    }
+}
+
+void LogManager::stopThreads() {
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        stopping = true;
+    }
+    logCondition.notify_all();
+    checkpointCondition.notify_all();
+    if (commitThread.joinable()) {
+        commitThread.join();
+    }
+    if (checkpointThread.joinable()) {
+        checkpointThread.join();
+    }
+}
+
+void LogManager::commitLoop() {
+    const auto interval = std::chrono::milliseconds(commitIntervalMs);
+    std::unique_lock<std::mutex> lock(logMutex);
+    while (!stopping) {
+        if (sealedSequence == globalSequence) {
+            logCondition.wait(lock);
+            continue;
+        }
+        const clock::time_point due = loggedAt[sealedSequence % NUM_LOGRECORDS_PER_LOGENTRY] + interval;
+        if (clock::now() < due) {
+            logCondition.wait_until(lock, due);
+            continue;
+        }
+        if (!commitLocked(lock)) {
+            logCondition.wait_for(lock, interval);
+        }
+    }
+}
+#endif
+
+
+bool LogManager::flushMetadata() {
+    bool ok = inodeTable->flushInodes();
+    ok = blockBitmap->flush() && ok;
+    if (inodeBitmap) {
+        ok = inodeBitmap->flush() && ok;
+    }
+    return ok;
+}
 
 bool LogManager::createCheckpoint() {
-    // logLock.lock();
-    block_t temp;
-    if (!blockManager->readBlock(0, (uint8_t *) &temp)) {
-        printf("Failed to read superblock\n");
-        // logLock.unlock();
-        return false;
+    // One checkpoint at a time; records that find the log full wait for it rather than start another.
+#ifdef NOT_KERNEL
+    {
+        std::unique_lock<std::mutex> lock(logMutex);
+        while (checkpointing) {
+            logCondition.wait(lock);
+        }
+        checkpointing = true;
+    }
+#else
+    checkpointing = true;
+#endif
+    const bool created = writeCheckpoint();
+#ifdef NOT_KERNEL
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        checkpointing = false;
     }
+    logCondition.notify_all();
+    checkpointCondition.notify_all();
+#else
+    checkpointing = false;
+#endif
+    return created;
+}
 
+bool LogManager::writeCheckpoint() {
+    // Walking the inode table and writing the checkpoint chain is housekeeping; let user I/O go first.
+    IoContextScope ioScope(IoPriority::IO_PRIORITY_BACKGROUND);
+    // logLock.lock();
     auto *checkpoint = new checkpointBlock_t{};
-    checkpoint->checkpointID = temp.superBlock.checkpointArr[temp.superBlock.latestCheckpointIndex] + 1;
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+        checkpoint->checkpointID = superBlock->latestCheckpointIndex + 1;
+    }
+    // The map is copied in one go, and every slot in the copy stops being fresh with it, so an update racing with
+    // the checkpoint either makes it in or finds its old slot still fresh and frees it as usual. Records apply their
+    // map change under logMutex, so the copy holds the changes of exactly the records before checkpointSequence.
+    std::vector<inode_index_t> locations;
+    uint64_t checkpointSequence;
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> lock(logMutex);
+#endif
+        checkpointSequence = globalSequence;
+        inodeTable->startCheckpointInterval(locations);
+    }
     checkpoint->magic = CHECKPOINT_MAGIC;
     checkpoint->isHeader = true;
-    checkpoint->sequenceNumber = globalSequence;
+    checkpoint->sequenceNumber = checkpointSequence;
     checkpoint->timestamp = get_timestamp();
     checkpoint->numEntries = 0;
     checkpoint->nextCheckpointBlock = NULL_INDEX;
-    block_index_t thisCheckpointIndex = blockBitmap->findNextFree();
+    block_index_t thisCheckpointIndex = blockBitmap->allocate();
     block_index_t firstCheckpointIndex = thisCheckpointIndex;
-    if (!blockBitmap->setAllocated(thisCheckpointIndex)) {
-        printf("Could not set block bitmap\n");
+    if (thisCheckpointIndex == NULL_INDEX) {
+        printf("Could not allocate checkpoint block\n");
         // logLock.unlock();
         return false;
     }
@@ -126,18 +497,17 @@ bool LogManager::createCheckpoint() {
     checkpointBlock_t *currentCheckpoint = checkpoint;
 
     // Calculate the total number of blocks covering the inode table.
-    inode_index_t totalInodes = temp.superBlock.inodeCount;
+    inode_index_t totalInodes = superBlock->inodeCount;
     inode_index_t entriesPerBlock = TABLE_ENTRIES_PER_BLOCK;
     inode_index_t totalBlocks = (totalInodes + entriesPerBlock - 1) / entriesPerBlock;
 
-    // Buffer to hold one block's worth of inode numbers.
-    inode_index_t inodeBuffer[TABLE_ENTRIES_PER_BLOCK];
+    if (locations.size() < static_cast<size_t>(totalBlocks) * entriesPerBlock) {
+        printf("Inode table is smaller than the inode count\n");
+        return false;
+    }
 
     for (inode_index_t blockIdx = 0; blockIdx < totalBlocks; blockIdx++) {
-        if (!inodeTable->readInodeBlock(blockIdx, inodeBuffer)) {
-            printf("Failed to read inode table block %d\n", blockIdx);
-            return false;
-        }
+        const inode_index_t *inodeBuffer = &locations[static_cast<size_t>(blockIdx) * entriesPerBlock];
         for (inode_index_t j = 0; j < entriesPerBlock; j++) {
             inode_index_t globalInodeIndex = blockIdx * entriesPerBlock + j;
             if (globalInodeIndex >= totalInodes)
@@ -152,9 +522,9 @@ bool LogManager::createCheckpoint() {
                     currentCheckpoint->entries[currentCheckpoint->numEntries++] = entry;
                 } else {
                     // Current checkpoint block is full, allocate a new one.
-                    newCheckpointIndex = blockBitmap->findNextFree();
-                    if (!blockBitmap->setAllocated(newCheckpointIndex)) {
-                        printf("Could not set block bitmap for new checkpoint block\n");
+                    newCheckpointIndex = blockBitmap->allocate(thisCheckpointIndex + 1);
+                    if (newCheckpointIndex == NULL_INDEX) {
+                        printf("Could not allocate new checkpoint block\n");
                         return false;
                     }
                     currentCheckpoint->nextCheckpointBlock = newCheckpointIndex;
@@ -182,45 +552,93 @@ bool LogManager::createCheckpoint() {
     }
     delete (currentCheckpoint);
 
+    // The on-disk inode table only has to be current as of a checkpoint; recovery replays the log after it.
+    if (!inodeTable->flush()) {
+        printf("Could not write inode table\n");
+        return false;
+    }
+    // Slots freed since the last checkpoint go back to the bitmap before the checkpoint's commit flushes it.
+    inodeTable->reclaimFreedSlots();
     // Create a checkpoint log record.
     logRecord_t checkpointRecord;
     checkpointRecord.payload.checkpoint.checkpointLocation = firstCheckpointIndex;
-    logOperation(LogOpType::LOG_UPDATE_CHECKPOINT, &checkpointRecord.payload);
+    if (!logOperation(LogOpType::LOG_UPDATE_CHECKPOINT, &checkpointRecord.payload, true)) {
+        printf("Could not log checkpoint\n");
+        return false;
+    }
 
-    // Update superblock to show new checkpoint.
-    temp.superBlock.latestCheckpointIndex++;
-    printf("checkpointed at latest checkpoint index: %d\n", temp.superBlock.latestCheckpointIndex);
-    temp.superBlock.checkpointArr[temp.superBlock.latestCheckpointIndex] = firstCheckpointIndex;
-    if (!blockManager->writeBlock(0, (uint8_t *)&temp)) {
-        printf("Could not write superblock\n");
+    // Reservations of threads that have stopped allocating would otherwise never come back.
+    blockBitmap->releaseReservations();
+    if (inodeBitmap) {
+        inodeBitmap->releaseReservations();
+    }
+
+    // Update superblock to show new checkpoint. The free counts are only brought up to date here; the live
+    // values are in the bitmaps, which are recounted at mount anyway. Everything up to the checkpoint's record is
+    // durable now, so mount can start looking for the end of the log there.
+    std::vector<block_index_t> dropped;
+    std::vector<block_index_t> kept;
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+        superBlock->freeDataBlockCount = blockBitmap->getFreeCount();
+        if (inodeBitmap) {
+            superBlock->freeInodeCount = inodeBitmap->getFreeCount();
+        }
+        const uint32_t id = ++superBlock->latestCheckpointIndex;
+        printf("checkpointed at latest checkpoint index: %d\n", id);
+        // The new checkpoint takes the place of the one NUM_CHECKPOINTS older, which is dropped once the
+        // superblock no longer names it, unless a snapshot of it is mounted. Pinned checkpoints that left earlier
+        // and have been unmounted since go with it.
+        block_index_t &slot = superBlock->checkpointArr[id % NUM_CHECKPOINTS];
+        if (slot != 0) {
+            const uint32_t evicted = id - NUM_CHECKPOINTS;
+            if (std::find(pinnedCheckpoints.begin(), pinnedCheckpoints.end(), evicted) != pinnedCheckpoints.end()) {
+                pinnedEvicted.emplace_back(evicted, slot);
+            } else {
+                dropped.push_back(slot);
+            }
+            dropped.insert(dropped.end(), deferredDrops.begin(), deferredDrops.end());
+            deferredDrops.clear();
+            kept.push_back(superBlock->checkpointArr[(id + 1) % NUM_CHECKPOINTS]);
+            for (const auto &pinned : pinnedEvicted) {
+                kept.push_back(pinned.second);
+            }
+        }
+        slot = firstCheckpointIndex;
+        superBlock->systemStateSeqNum = checkpointSequence;
+    }
+    if (!writeSuperBlock()) {
         return false;
     }
+    // Recovery now starts from this checkpoint, so the log blocks before its record can be reused.
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> lock(logMutex);
+#endif
+        logTail = checkpointSequence;
+#ifdef NOT_KERNEL
+        lastCheckpointAt = clock::now();
+#endif
+    }
+    if (!dropped.empty() && !dropCheckpoints(dropped, kept)) {
+        printf("Could not free dropped checkpoints\n");
+    }
     printf("Checkpoint created at block %d\n", firstCheckpointIndex);
     return true;
 }
 
 
 bool LogManager::recover() {
+    IoContextScope ioScope(IoPriority::IO_PRIORITY_BACKGROUND);
     printf("Recovery: Reapplying log entries from the last checkpoint...\n");
-    // Read the superblock to get the checkpoint information.
-    block_t superblockBlock;
-    if (!blockManager->readBlock(0, reinterpret_cast<uint8_t *>(&superblockBlock))) {
-        printf("Failed to read superblock\n");
-        return false;
-    }
-
-    //set readonly to false
-    superblockBlock.superBlock.readOnly = false;
-    if (!blockManager->writeBlock(0, reinterpret_cast<uint8_t *>(&superblockBlock))) {
-        printf("Failed to write superblock\n");
-        return false;
-    }
-
     // Get the latest checkpoint block index from the superblock.
-    block_index_t latestCheckpointIndex = superblockBlock.superBlock.checkpointArr[superblockBlock.superBlock.latestCheckpointIndex];
+    superBlock->readOnly = false;
+    block_index_t latestCheckpointIndex = getCheckpointBlock(superBlock->latestCheckpointIndex);
     checkpointBlock_t checkpoint;
     int64_t checkpointLogRecordIndex = -1; // initialize to an invalid value
-    printf("Latest global sequence number: %d\n", globalSequence);
+    printf("Latest global sequence number: %llu\n", static_cast<unsigned long long>(globalSequence));
     printf("Latest checkpoint block index: %d\n", latestCheckpointIndex);
 
     // Traverse the checkpoint chain.
@@ -258,17 +676,23 @@ bool LogManager::recover() {
         return false;
     }
 
+    logTail = checkpointLogRecordIndex;
+
     // Replay log records from the checkpoint's sequence number to the current global sequence.
     for (int64_t i = checkpointLogRecordIndex; i < globalSequence; i++) {
-        block_index_t logBlockIndex = logStartBlock + (i / NUM_LOGRECORDS_PER_LOGENTRY);
-        if (!blockManager->readBlock(logBlockIndex, reinterpret_cast<uint8_t *>(&currentLogEntry))) {
+        block_index_t logBlockIndex = logBlockFor(i);
+        if ((i == checkpointLogRecordIndex || i % NUM_LOGRECORDS_PER_LOGENTRY == 0) &&
+            !logDevice->readBlock(logBlockIndex, reinterpret_cast<uint8_t *>(&currentLogEntry))) {
             printf("Could not read log block at index %d\n", logBlockIndex);
             return false;
         }
         logRecord_t logRecord = currentLogEntry.records[i % NUM_LOGRECORDS_PER_LOGENTRY];
-        printf("Reapplying log record: sequence %d, type %d\n", logRecord.sequenceNumber, static_cast<uint16_t>(logRecord.opType));
+        printf("Reapplying log record: sequence %llu, type %d\n", static_cast<unsigned long long>(logRecord.sequenceNumber),
+               static_cast<uint16_t>(logRecord.opType));
         switch (logRecord.opType) {
             case LogOpType::LOG_OP_INODE_ADD:
+                inodeTable->replaySlotChange(inodeTable->getInodeLocation(logRecord.payload.inodeAdd.inodeIndex),
+                                             logRecord.payload.inodeAdd.inodeLocation);
                 if (!inodeTable->setInodeLocation(logRecord.payload.inodeAdd.inodeIndex,
                                                   logRecord.payload.inodeAdd.inodeLocation)) {
                     printf("Failed to apply LOG_OP_INODE_ADD for inode index %d\n", logRecord.payload.inodeAdd.inodeIndex);
@@ -276,6 +700,8 @@ bool LogManager::recover() {
                 }
                 break;
             case LogOpType::LOG_OP_INODE_UPDATE:
+                inodeTable->replaySlotChange(inodeTable->getInodeLocation(logRecord.payload.inodeUpdate.inodeIndex),
+                                             logRecord.payload.inodeUpdate.inodeLocation);
                 if (!inodeTable->setInodeLocation(logRecord.payload.inodeUpdate.inodeIndex,
                                                   logRecord.payload.inodeUpdate.inodeLocation)) {
                     printf("Failed to apply LOG_OP_INODE_UPDATE for inode index %d\n", logRecord.payload.inodeUpdate.inodeIndex);
@@ -283,6 +709,8 @@ bool LogManager::recover() {
                 }
                 break;
             case LogOpType::LOG_OP_INODE_DELETE:
+                inodeTable->replaySlotChange(inodeTable->getInodeLocation(logRecord.payload.inodeDelete.inodeIndex),
+                                             INODE_NULL_VALUE);
                 if (!inodeTable->setInodeLocation(logRecord.payload.inodeDelete.inodeIndex, NULL_INDEX)) {
                     printf("Failed to apply LOG_OP_INODE_DELETE for inode index %d\n", logRecord.payload.inodeDelete.inodeIndex);
                     return false;
@@ -296,34 +724,143 @@ bool LogManager::recover() {
                 return false;
         }
     }
+    inodeTable->finishReplay();
     printf("Recovery complete.\n");
     return true;
 }
 
 
 bool LogManager::mountReadOnlySnapshot(uint32_t checkpointID) {
-    // read superblock to get checkpoint information and set readonly to true
-    block_t superblockBlock;
-    if (!blockManager->readBlock(0, reinterpret_cast<uint8_t *>(&superblockBlock))) {
-        printf("Failed to read superblock\n");
-        return false;
+    // The mode only lives in the in-memory superblock; the next mount starts out writable again.
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+        superBlock->readOnly = true;
+    }
+    return applyCheckpoint(getCheckpointBlock(checkpointID));
+}
+
+block_index_t LogManager::getCheckpointBlock(uint32_t checkpointID) {
+#ifdef NOT_KERNEL
+    std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+    const uint32_t latest = superBlock->latestCheckpointIndex;
+    if (checkpointID == 0 || checkpointID > latest || latest - checkpointID >= NUM_CHECKPOINTS) {
+        return 0;
     }
-    superblockBlock.superBlock.readOnly = true;
-    if (!blockManager->writeBlock(0, reinterpret_cast<uint8_t *>(&superblockBlock))) {
-        printf("Failed to write superblock\n");
+    return superBlock->checkpointArr[checkpointID % NUM_CHECKPOINTS];
+}
+
+bool LogManager::pinCheckpoint(uint32_t checkpointID) {
+#ifdef NOT_KERNEL
+    std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+    const uint32_t latest = superBlock->latestCheckpointIndex;
+    const bool inSuperBlock = checkpointID != 0 && checkpointID <= latest && latest - checkpointID < NUM_CHECKPOINTS;
+    const bool pinned = std::find(pinnedCheckpoints.begin(), pinnedCheckpoints.end(), checkpointID) !=
+                        pinnedCheckpoints.end();
+    if (!inSuperBlock && !pinned) {
         return false;
     }
+    pinnedCheckpoints.push_back(checkpointID);
+    return true;
+}
 
-    //clear the inode table
+void LogManager::unpinCheckpoint(uint32_t checkpointID) {
+#ifdef NOT_KERNEL
+    std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+    const auto pin = std::find(pinnedCheckpoints.begin(), pinnedCheckpoints.end(), checkpointID);
+    if (pin == pinnedCheckpoints.end()) {
+        return;
+    }
+    pinnedCheckpoints.erase(pin);
+    if (std::find(pinnedCheckpoints.begin(), pinnedCheckpoints.end(), checkpointID) != pinnedCheckpoints.end()) {
+        return;
+    }
+    for (auto it = pinnedEvicted.begin(); it != pinnedEvicted.end(); ++it) {
+        if (it->first == checkpointID) {
+            deferredDrops.push_back(it->second);
+            pinnedEvicted.erase(it);
+            return;
+        }
+    }
+}
 
-    block_index_t checkpointBlockIndex = superblockBlock.superBlock.checkpointArr[checkpointID];
-    return applyCheckpoint(checkpointBlockIndex);
+bool LogManager::readCheckpointChain(block_index_t first, std::vector<checkpoint_entry_t> &entries,
+                                     std::vector<block_index_t> &blocks) {
+    checkpointBlock_t checkpoint;
+    for (block_index_t index = first; index != NULL_INDEX; index = checkpoint.nextCheckpointBlock) {
+        if (!blockManager->readBlock(index, reinterpret_cast<uint8_t *>(&checkpoint))) {
+            printf("Failed to read checkpoint block at index %d\n", index);
+            return false;
+        }
+        if (checkpoint.magic != CHECKPOINT_MAGIC) {
+            printf("Invalid checkpoint block at index %d\n", index);
+            return false;
+        }
+        blocks.push_back(index);
+        entries.insert(entries.end(), checkpoint.entries, checkpoint.entries + checkpoint.numEntries);
+    }
+    return true;
+}
+
+bool LogManager::dropCheckpoints(const std::vector<block_index_t> &dropped, std::vector<block_index_t> kept) {
+    // A chain dropped later in the list still holds its slots while the earlier ones go, so a slot shared by
+    // several dropped chains is freed once, with the last of them.
+    kept.insert(kept.end(), dropped.begin(), dropped.end());
+    bool ok = true;
+    for (const block_index_t evicted : dropped) {
+        kept.erase(std::find(kept.begin(), kept.end(), evicted));
+        if (!dropCheckpoint(evicted, kept)) {
+            printf("Could not free dropped checkpoint at block %d\n", evicted);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool LogManager::dropCheckpoint(block_index_t evicted, const std::vector<block_index_t> &kept) {
+    IoContextScope ioScope(IoPriority::IO_PRIORITY_BACKGROUND);
+    std::vector<checkpoint_entry_t> keptEntries;
+    std::vector<block_index_t> keptBlocks;
+    std::vector<checkpoint_entry_t> entries;
+    std::vector<block_index_t> blocks;
+    for (const block_index_t chain : kept) {
+        if (!readCheckpointChain(chain, keptEntries, keptBlocks)) {
+            return false;
+        }
+    }
+    if (!readCheckpointChain(evicted, entries, blocks)) {
+        return false;
+    }
+    // Slots are only reused once freed, and a slot any checkpoint maps to is only freed here, so an inode that
+    // has moved off a slot never comes back to it. A slot the dropped checkpoint maps to is therefore still in use
+    // exactly when a kept checkpoint maps to it too (necessarily for the same inode): the oldest checkpoint in
+    // the superblock covers the live table and every newer checkpoint, and pinned ones cover themselves.
+    std::vector<inode_index_t> keptLocations;
+    keptLocations.reserve(keptEntries.size());
+    for (const checkpoint_entry_t &entry : keptEntries) {
+        keptLocations.push_back(entry.inodeLocation);
+    }
+    std::sort(keptLocations.begin(), keptLocations.end());
+    for (const checkpoint_entry_t &entry : entries) {
+        if (!std::binary_search(keptLocations.begin(), keptLocations.end(), entry.inodeLocation)) {
+            inodeTable->freeInodeSlot(entry.inodeLocation);
+        }
+    }
+    bool ok = true;
+    for (const block_index_t block : blocks) {
+        ok = blockBitmap->setUnallocated(block) && ok;
+    }
+    return ok;
 }
 
 bool LogManager::applyCheckpoint(block_index_t checkpointBlockIndex) {
     checkpointBlock_t checkpoint;
     int64_t checkpointLogRecordIndex = -1; // initialize to an invalid value
-    printf("Latest global sequence number: %d\n", globalSequence);
+    printf("Latest global sequence number: %llu\n", static_cast<unsigned long long>(globalSequence));
     printf("Latest checkpoint block index: %d\n", checkpointBlockIndex);
 
     // Traverse the checkpoint chain.
@@ -365,6 +902,67 @@ bool LogManager::applyCheckpoint(block_index_t checkpointBlockIndex) {
     return true;
 }
 
+bool LogManager::unmount() {
+#ifdef NOT_KERNEL
+    stopThreads();
+#endif
+    // Snapshots end with the mount, so pinned checkpoints that have left the superblock can go now.
+    std::vector<block_index_t> dropped;
+    std::vector<block_index_t> kept;
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+        dropped.swap(deferredDrops);
+        for (const auto &pinned : pinnedEvicted) {
+            dropped.push_back(pinned.second);
+        }
+        pinnedEvicted.clear();
+        pinnedCheckpoints.clear();
+        if (!dropped.empty()) {
+            kept.push_back(superBlock->checkpointArr[(superBlock->latestCheckpointIndex + 1) % NUM_CHECKPOINTS]);
+        }
+    }
+    if (!dropped.empty() && !dropCheckpoints(dropped, kept)) {
+        printf("Could not free dropped checkpoints\n");
+    }
+    if (!commit()) {
+        return false;
+    }
+    // Slots freed by the drops and the last commit only reach the bitmap once no reader can be using them; the
+    // next mount trusts the bitmap on disk, so anything still pending here would stay allocated for good.
+    inodeTable->reclaimFreedSlots();
+    if (!flushMetadata()) {
+        printf("Could not write bitmaps\n");
+        return false;
+    }
+    // With the whole log durable the superblock can point at its last record, so the next mount has nothing to
+    // scan for.
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+        superBlock->systemStateSeqNum = globalSequence - 1;
+    }
+    return writeSuperBlock();
+}
+
+bool LogManager::writeSuperBlock() {
+    block_t temp{};
+    {
+#ifdef NOT_KERNEL
+        std::lock_guard<std::mutex> superBlockLock(superBlockMutex);
+#endif
+        temp.superBlock = *superBlock;
+    }
+    if (!blockManager->writeBlock(0, reinterpret_cast<uint8_t *>(&temp))) {
+        printf("Could not write superblock\n");
+        return false;
+    }
+    return true;
+}
+
 uint64_t LogManager::get_timestamp() {
     // This function should return a current 64-bit timestamp. Will need some hardware support for this.
     static uint64_t dummyTime = 0;
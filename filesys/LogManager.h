@@ -8,6 +8,13 @@
 // #include "SpinLock.h"     // Will need to use spinlock from kernel team
 #include "stdint.h"
 #include "cstring"
+#include "vector"
+#ifdef NOT_KERNEL
+#include "chrono"
+#include "condition_variable"
+#include "mutex"
+#include "thread"
+#endif
 
 #include "InodeTable.h"
 
@@ -19,36 +26,135 @@
 
 namespace fs {
 
+// When to checkpoint without being asked; a trigger set to 0 is off. Checkpoints bound how much of the log
+// recovery replays and let the log reuse the blocks before them. Under NOT_KERNEL a background thread takes
+// them, so logging never waits for one unless the log is full; the kernel build checkpoints inline once a
+// record crosses a threshold and has no timer. Thresholds that a single record or log block already meets would
+// checkpoint after every operation and are rejected at mount.
+struct CheckpointPolicy
+{
+    uint32_t logFillPercent = 0;  // share of the log area holding records since the last checkpoint
+    uint64_t replayRecords = 0;   // records recovery would replay
+    uint32_t intervalMs = 0;      // time since the last checkpoint, if anything has been logged since
+};
+
+// Records are group committed: they accumulate in the current log entry and are written together, with one log
+// block write for the whole group. Under NOT_KERNEL a commit is started when
+//   - the log entry fills up,
+//   - a caller needs its record durable (every caller, when commitIntervalMs is 0), or
+//   - the oldest uncommitted record has waited commitIntervalMs, checked by a background thread.
+// Callers that need durability while a commit is being written wait for it and then commit everything logged in
+// the meantime as the next group. The kernel build commits every record as it is logged.
 class LogManager {
 public:
-    // Constructor: pass a pointer to BlockManager and specify the log area (starting block and number of blocks).
-    LogManager(BlockManager* blockManager, BitmapManager* blockBitmap, InodeTable* inode_table, uint32_t startBlock, uint32_t numBlocks, uint64_t latestSystemSeq);
-
-    // append to the log
-    bool logOperation(LogOpType opType, LogRecordPayload* payload);
-
-
-    // Recovery: replay log entries from the last checkpoint (simplified).
+    struct CommitStats
+    {
+        uint64_t records = 0;         // records committed
+        uint64_t commits = 0;         // groups written, one log block write each
+        uint64_t totalLatencyNs = 0;  // summed over committed records, from logging to durable
+        uint64_t maxLatencyNs = 0;
+    };
+
+    // Constructor: pass a pointer to BlockManager and the filesystem's in-memory superblock, which gives the log
+    // area and the last log record known to be durable. The superblock is only written back at checkpoints and by
+    // unmount; the log past its sequence number is found by checking records until one fails to validate.
+    // If logDevice is given, the log area is a block range on that device instead of on blockManager; the
+    // superblock and checkpoints always stay on blockManager.
+    // The dirty blocks of blockBitmap and inodeBitmap, and the inode table's open inode block, are written back
+    // ahead of every log entry write, so the allocations and inodes a logged operation depends on are on disk
+    // before the record is.
+    LogManager(BlockManager* blockManager, BitmapManager* blockBitmap, BitmapManager* inodeBitmap,
+               InodeTable* inode_table, superBlock_t* superBlock,
+               BlockManager* logDevice = nullptr, uint32_t commitIntervalMs = 0,
+               const CheckpointPolicy& checkpointPolicy = {});
+    ~LogManager();
+
+    // Append to the log. With durable set, or a commit interval of 0, the record is on disk when this returns;
+    // otherwise it is written within the commit interval. Inode records also update the live inode map as they
+    // are logged.
+    bool logOperation(LogOpType opType, LogRecordPayload* payload, bool durable = false);
+
+    // Makes every record logged so far durable.
+    bool commit();
+
+    CommitStats getCommitStats() const;
+
+    // Commits the log, stops the commit thread and writes the superblock with the log's end.
+    bool unmount();
+
+
+    // Recovery: replay log entries from the last checkpoint (simplified). Run at every mount of an existing
+    // filesystem, since the inode table is only written back at checkpoints.
     bool recover();
 
     // Create a checkpoint (lock fileystem, read current inode table, create sufficient checkpoint blocks and write
     // to disk, then create return a checkpoint logrecord that points to the new checkpoint). Note that this does not
     // actually write to the log or update the superblock - the expecation is that this will be done by the caller
+    // logOperation also calls this when the log area is full, since the log can only wrap past a checkpoint.
     bool createCheckpoint();
 
     // Mount as a read-only snapshot based on a checkpoint ID.
     bool mountReadOnlySnapshot(uint32_t checkpointID);
 
+    // First block of the checkpoint's chain, or 0 if there is no such checkpoint or it has been dropped to make
+    // room for newer ones.
+    block_index_t getCheckpointBlock(uint32_t checkpointID);
+    // Keeps a checkpoint's blocks and inode slots allocated while a snapshot of it is mounted, even once it has
+    // left the superblock. Pins nest. Returns false, pinning nothing, if the checkpoint has already been dropped.
+    bool pinCheckpoint(uint32_t checkpointID);
+    // A pinned checkpoint that has left the superblock is dropped at the next checkpoint, or at unmount, once its
+    // last pin goes.
+    void unpinCheckpoint(uint32_t checkpointID);
+
     uint64_t globalSequence;   // current system log sequence number
 
+    // The live inode table, whichever table the filesystem currently has mounted.
+    InodeTable* getInodeTable() const { return inodeTable; }
+
 private:
     BlockManager* blockManager;
+    BlockManager* logDevice;  // device holding the log area (blockManager unless an external log is used)
     InodeTable* inodeTable;
     BitmapManager* blockBitmap;
+    BitmapManager* inodeBitmap;
+    superBlock_t* superBlock;  // owned by the filesystem, written to disk only by writeSuperBlock
     uint32_t logStartBlock; // starting block of the dedicated log area
     uint32_t logNumBlocks;  // number of blocks allocated for the log area
+    uint64_t logTail = 0;   // first record recovery needs: the latest checkpoint's
+    bool checkpointing = false;
+    CheckpointPolicy checkpointPolicy;
+    // Guarded by superBlockMutex: the pinned checkpoint IDs, the pinned ones that have left the superblock (ID and
+    // first block), and the first blocks of those unpinned since, waiting to be dropped.
+    std::vector<uint32_t> pinnedCheckpoints;
+    std::vector<std::pair<uint32_t, block_index_t>> pinnedEvicted;
+    std::vector<block_index_t> deferredDrops;
 
     bool applyCheckpoint(block_index_t checkpointBlockIndex);
+    bool flushMetadata();
+    bool writeSuperBlock();
+    bool writeCheckpoint();
+    // Frees the chains of checkpoints that have left the superblock, and the inode slots that only they referenced;
+    // kept holds the chains still allocated that may share slots with them: the oldest checkpoint in the
+    // superblock and any pinned ones that have left it.
+    bool dropCheckpoints(const std::vector<block_index_t>& dropped, std::vector<block_index_t> kept);
+    bool dropCheckpoint(block_index_t evicted, const std::vector<block_index_t>& kept);
+    bool readCheckpointChain(block_index_t first, std::vector<checkpoint_entry_t>& entries,
+                             std::vector<block_index_t>& blocks);
+    // Applies an inode record's change to the live inode map. Called with logMutex held.
+    bool applyToInodeMap(const logRecord_t& record);
+    // Whether the log has grown past the fill or replay threshold. Called with logMutex held.
+    bool checkpointDue() const;
+    // The log area is a ring of log entries, one per block.
+    block_index_t logBlockFor(uint64_t sequenceNumber) const
+    {
+        return logStartBlock + (sequenceNumber / NUM_LOGRECORDS_PER_LOGENTRY) % logNumBlocks;
+    }
+    // Whether record sequenceNumber fits in the log without overwriting anything from logTail on.
+    bool hasRoom(uint64_t sequenceNumber, bool forCheckpoint) const;
+    // Returns the last valid record from start on; entry holds start's log block and is left holding the last one's.
+    uint64_t findLogTail(uint64_t start, logEntry_t& entry);
+    // Writes what a commit depends on, then the log entry holding records up to end - 1.
+    bool writeCommit(const logEntry_t& entry, uint64_t end);
 
 
     // // Spinlock to protect log operations.
@@ -60,6 +166,32 @@ private:
     // Current log entry
     logEntry_t currentLogEntry;
 
+    CommitStats stats;
+#ifdef NOT_KERNEL
+    using clock = std::chrono::steady_clock;
+
+    // Commits [durableSequence, globalSequence) as one group once no other commit is in progress. Called with
+    // logMutex held through lock, which is released during the I/O.
+    bool commitLocked(std::unique_lock<std::mutex>& lock);
+    void commitLoop();
+    void checkpointLoop();
+    void stopThreads();
+
+    uint32_t commitIntervalMs;
+    mutable std::mutex logMutex;           // guards the current entry, the sequence numbers and stats
+    std::condition_variable logCondition;  // signalled when a commit starts or ends and when the timer is needed
+    std::mutex superBlockMutex;            // guards the in-memory superblock
+    uint64_t sealedSequence;               // records below this have been copied into a commit
+    uint64_t durableSequence;              // records below this are on disk
+    bool committing = false;
+    bool stopping = false;
+    clock::time_point loggedAt[NUM_LOGRECORDS_PER_LOGENTRY];  // when each record of the current entry was logged
+    std::thread commitThread;              // only with a commit interval
+    std::condition_variable checkpointCondition;  // signalled when a checkpoint is due or has finished
+    clock::time_point lastCheckpointAt;
+    std::thread checkpointThread;          // only with a checkpoint policy
+#endif
+
     // Helper: Get a timestamp (assumed to be provided by the kernel).
     uint64_t get_timestamp();
 };
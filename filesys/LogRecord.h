@@ -61,7 +61,7 @@ typedef struct logRecord {
     uint64_t sequenceNumber;    // Incremental sequence number (8 bytes).
     uint32_t magic;             // Magic for log validation (4 bytes).
     LogOpType opType;           // Operation type (2 bytes)
-    uint16_t padding;           // Padding (2 bytes).
+    uint16_t checksum;          // Fletcher-16 of the record with this field zero (2 bytes).
     LogRecordPayload payload;   // Operation-specific payload (16 bytes).
 } logRecord_t;
 
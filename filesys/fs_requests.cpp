@@ -3,6 +3,7 @@
 //
 
 #include "fs_requests.h"
+#include "../interface/IoContext.h"
 #include "cassert"
 #include "cstring"
 #include "cstdlib"
@@ -16,13 +17,14 @@
 
 namespace fs {
 #ifdef NOT_KERNEL
-    void init(BlockManager* block_manager) {
-        fileSystem = FileSystem::getInstance(block_manager);
+    void init(BlockManager* block_manager, const FileSystemOptions& options) {
+        fileSystem = FileSystem::getInstance(block_manager, options);
         blockManager = block_manager;
     }
 #endif
 
-    fs_resp_add_dir_t fs_req_add_dir(inode_index_t dir, inode_index_t file_to_add, const string& name) {
+    fs_resp_add_dir_t fs_req_add_dir(inode_index_t dir, inode_index_t file_to_add, const string& name, uint32_t tenant) {
+        IoContextScope ioScope(tenant);
         FileSystem* fileSystem = FileSystem::getInstance();
         fs_resp_add_dir_t resp{};
 
@@ -39,7 +41,8 @@ namespace fs {
         return resp;
     }
 
-fs_resp_create_file_t fs_req_create_file(inode_index_t cwd, bool is_dir, const string& name, uint16_t permissions) {
+fs_resp_create_file_t fs_req_create_file(inode_index_t cwd, bool is_dir, const string& name, uint16_t permissions, uint32_t tenant) {
+    IoContextScope ioScope(tenant);
     fs_resp_create_file_t resp{};
     FileSystem* fileSystem = FileSystem::getInstance();
 
@@ -70,7 +73,8 @@ fs_resp_create_file_t fs_req_create_file(inode_index_t cwd, bool is_dir, const s
     return resp;
 }
 
-fs_resp_remove_file_t fs_req_remove_file(inode_index_t inode_index, const string& name) {
+fs_resp_remove_file_t fs_req_remove_file(inode_index_t inode_index, const string& name, uint32_t tenant) {
+    IoContextScope ioScope(tenant);
     fs_resp_remove_file_t resp{};
     FileSystem* fileSystem = FileSystem::getInstance();
     if (fileSystem->isReadOnly()) {
@@ -85,7 +89,8 @@ fs_resp_remove_file_t fs_req_remove_file(inode_index_t inode_index, const string
     resp.status = ok ? FS_RESP_SUCCESS : FS_RESP_ERROR_NOT_FOUND;
     return resp;
 }
-fs_resp_read_dir_t fs_req_read_dir(inode_index_t inode_index) {
+fs_resp_read_dir_t fs_req_read_dir(inode_index_t inode_index, uint32_t tenant) {
+    IoContextScope ioScope(tenant);
     fs_resp_read_dir_t resp{};
     FileSystem* fileSystem = FileSystem::getInstance();
     resp.entry_count = 0;
@@ -105,7 +110,8 @@ fs_resp_read_dir_t fs_req_read_dir(inode_index_t inode_index) {
 
     return resp;
 }
-    fs_resp_open_t fs_req_open(const string& path) {
+    fs_resp_open_t fs_req_open(const string& path, uint32_t tenant) {
+        IoContextScope ioScope(tenant);
         fs_resp_open_t resp{};
         FileSystem* fileSystem = FileSystem::getInstance();
         resp.status = FS_RESP_ERROR_NOT_FOUND;
@@ -155,7 +161,8 @@ fs_resp_read_dir_t fs_req_read_dir(inode_index_t inode_index) {
         return resp;
     }
 
-fs_resp_write_t fs_req_write(inode_index_t inode_index, const char* buf, int offset, int n_bytes) {
+fs_resp_write_t fs_req_write(inode_index_t inode_index, const char* buf, int offset, int n_bytes, uint32_t tenant) {
+    IoContextScope ioScope(tenant);
     fs_resp_write_t resp{};
     FileSystem* fileSystem = FileSystem::getInstance();
 
@@ -178,7 +185,8 @@ fs_resp_write_t fs_req_write(inode_index_t inode_index, const char* buf, int off
         return resp;
     }
 
-fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int n_bytes) {
+fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int n_bytes, uint32_t tenant) {
+    IoContextScope ioScope(tenant);
     fs_resp_read_t resp{};
     FileSystem* fileSystem = FileSystem::getInstance();
     File file(inode_index, fileSystem->inodeTable, fileSystem->inodeBitmap,
@@ -195,7 +203,8 @@ fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int
     }
 
 
-    fs_resp_mount_snapshot_t fs_req_mount_snapshot(uint32_t checkpointID) {
+    fs_resp_mount_snapshot_t fs_req_mount_snapshot(uint32_t checkpointID, uint32_t tenant) {
+    IoContextScope ioScope(tenant);
     FileSystem* fileSystem = FileSystem::getInstance();
         fs_resp_mount_snapshot_t resp{};
         bool success = fileSystem->mountReadOnlySnapshot(checkpointID);
@@ -207,7 +216,8 @@ fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int
         return resp;
     }
 
-    fs_resp_create_checkpoint_t fs_req_create_checkpoint() {
+    fs_resp_create_checkpoint_t fs_req_create_checkpoint(uint32_t tenant) {
+        IoContextScope ioScope(tenant);
         FileSystem* fileSystem = FileSystem::getInstance();
         fs_resp_create_checkpoint_t resp{};
         if (fileSystem->isReadOnly()) {
@@ -223,22 +233,64 @@ fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int
         return resp;
     }
 
-    fs_resp_list_checkpoints_t fs_req_list_checkpoints() {
+    fs_resp_list_checkpoints_t fs_req_list_checkpoints(uint32_t tenant) {
+        IoContextScope ioScope(tenant);
         FileSystem* fileSystem = FileSystem::getInstance();
         fs_resp_list_checkpoints_t resp{};
-        BlockManager* bm = fileSystem->blockManager;
-        block_t block{};
-        if (!bm->readBlock(0, block.data)) {
-            resp.status = FS_RESP_ERROR_INVALID;
-            return resp;
-        }
-        resp.num_checkpoints = block.superBlock.latestCheckpointIndex;
-        for (int i = 0; i < resp.num_checkpoints; i++) {
-            resp.checkpoint_ids[i] = i;
+        // Only the latest NUM_CHECKPOINTS checkpoints are kept.
+        const uint32_t latest = fileSystem->getSuperBlock()->latestCheckpointIndex;
+        const uint32_t oldest = latest >= NUM_CHECKPOINTS ? latest - NUM_CHECKPOINTS + 1 : 1;
+        for (uint32_t id = oldest; id <= latest; id++) {
+            resp.checkpoint_ids[resp.num_checkpoints++] = id;
         }
         resp.status = FS_RESP_SUCCESS;
         return resp;
     }
 
+    fs_resp_statfs_t fs_req_statfs(uint32_t tenant) {
+        IoContextScope ioScope(tenant);
+        FileSystem* fileSystem = FileSystem::getInstance();
+        fs_resp_statfs_t resp{};
+        const FileSystemUsage usage = fileSystem->getUsage();
+        resp.block_size = BlockManager::BLOCK_SIZE;
+        resp.total_blocks = usage.totalBlocks;
+        resp.free_blocks = usage.freeBlocks;
+        resp.total_inodes = usage.totalInodes;
+        resp.free_inodes = usage.freeInodes;
+        resp.status = FS_RESP_SUCCESS;
+        return resp;
+    }
+
+    fs_resp_sync_t fs_req_sync(uint32_t tenant) {
+        IoContextScope ioScope(tenant);
+        FileSystem* fileSystem = FileSystem::getInstance();
+        fs_resp_sync_t resp{};
+        resp.status = fileSystem->logManager->commit() ? FS_RESP_SUCCESS : FS_RESP_ERROR_INVALID;
+        return resp;
+    }
+
+    fs_resp_log_stats_t fs_req_log_stats(uint32_t tenant) {
+        IoContextScope ioScope(tenant);
+        FileSystem* fileSystem = FileSystem::getInstance();
+        fs_resp_log_stats_t resp{};
+        const LogManager::CommitStats stats = fileSystem->logManager->getCommitStats();
+        resp.records = stats.records;
+        resp.commits = stats.commits;
+        resp.avg_commit_latency_ns = stats.records ? stats.totalLatencyNs / stats.records : 0;
+        resp.max_commit_latency_ns = stats.maxLatencyNs;
+        resp.status = FS_RESP_SUCCESS;
+        return resp;
+    }
+
+    fs_resp_unmount_t fs_req_unmount(uint32_t tenant) {
+        IoContextScope ioScope(tenant);
+        fs_resp_unmount_t resp{};
+        resp.status = FileSystem::destroyInstance() ? FS_RESP_SUCCESS : FS_RESP_ERROR_INVALID;
+#ifdef NOT_KERNEL
+        fileSystem = nullptr;
+#endif
+        return resp;
+    }
+
 }
 
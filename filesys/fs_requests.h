@@ -19,7 +19,7 @@ namespace fs {
     inline FileSystem* fileSystem;
     inline BlockManager* blockManager;
     // Function to initialize the filesystem - must be run before calling any other function and takes a BlockManager
-    void init(BlockManager* block_manager);
+    void init(BlockManager* block_manager, const FileSystemOptions& options = {});
 #endif
 
     // Enum for different request types
@@ -94,6 +94,31 @@ namespace fs {
         block_index_t checkpoint_ids[128]; // max checkpoints is 128
     };
 
+    struct fs_resp_statfs_t {
+        fs_resp_status_t status;
+        uint32_t block_size;
+        uint64_t total_blocks;
+        uint64_t free_blocks;
+        uint64_t total_inodes;
+        uint64_t free_inodes;
+    };
+
+    struct fs_resp_sync_t {
+        fs_resp_status_t status;
+    };
+
+    struct fs_resp_unmount_t {
+        fs_resp_status_t status;
+    };
+
+    struct fs_resp_log_stats_t {
+        fs_resp_status_t status;
+        uint64_t records;               // log records committed since mount
+        uint64_t commits;               // log block writes they took
+        uint64_t avg_commit_latency_ns; // from logging a record to it being on disk
+        uint64_t max_commit_latency_ns;
+    };
+
     // Union of all response types
     union fs_response_data_t {
         fs_resp_add_dir_t add_dir;
@@ -112,35 +137,50 @@ namespace fs {
         fs_response_data_t data;
     };
 
+    // Every request takes the id of the client/tenant it is issued for (default 0). All block I/O performed while
+    // serving the request is charged to that tenant by the block layer's QoS stage, if one is installed.
+
     // Add directory entry
-    fs_resp_add_dir_t fs_req_add_dir(inode_index_t dir, inode_index_t file_to_add, const string& name);
+    fs_resp_add_dir_t fs_req_add_dir(inode_index_t dir, inode_index_t file_to_add, const string& name, uint32_t tenant = 0);
     
     // Create file or directory
-    fs_resp_create_file_t fs_req_create_file(inode_index_t cwd, bool is_dir, const string& name, uint16_t permissions);
+    fs_resp_create_file_t fs_req_create_file(inode_index_t cwd, bool is_dir, const string& name, uint16_t permissions, uint32_t tenant = 0);
     
     // Remove file or directory
-    fs_resp_remove_file_t fs_req_remove_file(inode_index_t inode_index, const string& name);
+    fs_resp_remove_file_t fs_req_remove_file(inode_index_t inode_index, const string& name, uint32_t tenant = 0);
     
     // Read directory contents
-    fs_resp_read_dir_t fs_req_read_dir(inode_index_t inode_index);
+    fs_resp_read_dir_t fs_req_read_dir(inode_index_t inode_index, uint32_t tenant = 0);
     
     // Open file by path
-    fs_resp_open_t fs_req_open(const string& path);
+    fs_resp_open_t fs_req_open(const string& path, uint32_t tenant = 0);
     
     // Write to file
-    fs_resp_write_t fs_req_write(inode_index_t inode_index, const char* buf, int offset, int n_bytes);
+    fs_resp_write_t fs_req_write(inode_index_t inode_index, const char* buf, int offset, int n_bytes, uint32_t tenant = 0);
     
     // Read from file
-    fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int n_bytes);
+    fs_resp_read_t fs_req_read(inode_index_t inode_index, char* buf, int offset, int n_bytes, uint32_t tenant = 0);
     
     // Mount snapshot
-    fs_resp_mount_snapshot_t fs_req_mount_snapshot(uint32_t checkpointID);
+    fs_resp_mount_snapshot_t fs_req_mount_snapshot(uint32_t checkpointID, uint32_t tenant = 0);
 
     // Create checkpoint
-    fs_resp_create_checkpoint_t fs_req_create_checkpoint();
+    fs_resp_create_checkpoint_t fs_req_create_checkpoint(uint32_t tenant = 0);
 
     // List all checkpoints
-    fs_resp_list_checkpoints_t fs_req_list_checkpoints();
+    fs_resp_list_checkpoints_t fs_req_list_checkpoints(uint32_t tenant = 0);
+
+    // Report capacity and free space (answered from in-memory counters, no disk I/O)
+    fs_resp_statfs_t fs_req_statfs(uint32_t tenant = 0);
+
+    // Wait until every operation completed so far is on disk
+    fs_resp_sync_t fs_req_sync(uint32_t tenant = 0);
+
+    // Report group commit throughput (records per log write) and latency
+    fs_resp_log_stats_t fs_req_log_stats(uint32_t tenant = 0);
+
+    // Make everything durable and release the filesystem; init mounts the device again
+    fs_resp_unmount_t fs_req_unmount(uint32_t tenant = 0);
 
 
 } // namespace fs
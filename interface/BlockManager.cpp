@@ -3,7 +3,7 @@
 namespace fs {
 
 BlockManager::BlockManager(FakeDiskDriver& disk, const FakeDiskDriver::Partition& partition, int numBlocks)
-    : disk(disk), partition(partition), numBlocks(numBlocks)
+    : disk(&disk), partition(partition), numBlocks(numBlocks)
 {
     // Calculate the number of sectors per block.
     sectorsPerBlock = BLOCK_SIZE / FakeDiskDriver::SECTOR_SIZE;
@@ -15,6 +15,12 @@ BlockManager::BlockManager(FakeDiskDriver& disk, const FakeDiskDriver::Partition
     }
 }
 
+BlockManager::BlockManager(int numBlocks)
+    : disk(nullptr), partition{0, 0, ""}, numBlocks(numBlocks), numSectors(0), startSector(0),
+      sectorsPerBlock(BLOCK_SIZE / FakeDiskDriver::SECTOR_SIZE)
+{
+}
+
 bool BlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
 {
     // std::cout << "\tReading block " << blockIndex << "\n";
@@ -29,7 +35,7 @@ bool BlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
     // block.resize(BLOCK_SIZE);
     for (size_t i = 0; i < sectorsPerBlock; i++)
     {
-        if (!disk.readSector(startSector + i, buffer + i * FakeDiskDriver::SECTOR_SIZE))
+        if (!disk->readSector(startSector + i, buffer + i * FakeDiskDriver::SECTOR_SIZE))
         {
             std::cerr << "readBlock: failed to read sector " << (startSector + i) << "\n";
             return false;
@@ -56,7 +62,7 @@ bool BlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
 
     for (size_t i = 0; i < sectorsPerBlock; i++)
     {
-        if (!disk.writeSector(startSector + i, buffer + i * FakeDiskDriver::SECTOR_SIZE))
+        if (!disk->writeSector(startSector + i, buffer + i * FakeDiskDriver::SECTOR_SIZE))
         {
             std::cerr << "writeBlock: failed to write sector " << (startSector + i) << "\n";
             return false;
@@ -65,4 +71,28 @@ bool BlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
     return true;
 }
 
-} // namespace fs
\ No newline at end of file
+bool BlockManager::readBlocks(const size_t blockIndex, const size_t count, uint8_t* buffer)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!readBlock(blockIndex + i, buffer + i * BLOCK_SIZE))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BlockManager::writeBlocks(const size_t blockIndex, const size_t count, const uint8_t* buffer)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!writeBlock(blockIndex + i, buffer + i * BLOCK_SIZE))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace fs
@@ -31,13 +31,15 @@ public:
     BlockManager(int numSectors, int startSector);
     #endif
 
+    virtual ~BlockManager() = default;
+
     /**
      * Reads a file system block (4096 bytes) from the partition.
      * @param blockIndex Logical block index (0-based within the partition).
      * @param buffer      Output buffer (will be resized to BLOCK_SIZE).
      * @return true if the block was read successfully.
      */
-    bool readBlock(size_t blockIndex, uint8_t* buffer);
+    virtual bool readBlock(size_t blockIndex, uint8_t* buffer);
 
     /**
      * Writes a file system block (4096 bytes) to the partition.
@@ -45,13 +47,41 @@ public:
      * @param buffer      Input buffer of size BLOCK_SIZE.
      * @return true if the block was written successfully.
      */
-    bool writeBlock(size_t blockIndex, const uint8_t* buffer);
+    virtual bool writeBlock(size_t blockIndex, const uint8_t* buffer);
+
+    /**
+     * Reads a run of consecutive blocks. The default implementation issues one readBlock per block;
+     * managers that span several devices override this to overlap the transfers.
+     * @param blockIndex First logical block index.
+     * @param count      Number of blocks to read.
+     * @param buffer     Output buffer of size count * BLOCK_SIZE.
+     * @return true if every block was read successfully.
+     */
+    virtual bool readBlocks(size_t blockIndex, size_t count, uint8_t* buffer);
+
+    /**
+     * Writes a run of consecutive blocks.
+     * @param blockIndex First logical block index.
+     * @param count      Number of blocks to write.
+     * @param buffer     Input buffer of size count * BLOCK_SIZE.
+     * @return true if every block was written successfully.
+     */
+    virtual bool writeBlocks(size_t blockIndex, size_t count, const uint8_t* buffer);
 
     uint32_t getNumBlocks() const
     {
         return numBlocks;
     }
 
+protected:
+    /**
+     * Constructor for managers that are composed of other BlockManagers (striping, mirroring, ...)
+     * and therefore do not map onto a single partition themselves.
+     * @param numBlocks  Number of logical blocks exposed.
+     */
+    explicit BlockManager(int numBlocks);
+
+public:
     #ifndef NOT_KERNEL
     uint64_t blockToSectorIndex(size_t blockIndex);
     bool isInvalidSectorIndex(size_t sectorIndex);
@@ -59,7 +89,7 @@ public:
 
 private:
     #ifdef NOT_KERNEL
-    FakeDiskDriver& disk;
+    FakeDiskDriver* disk;
     FakeDiskDriver::Partition partition;
     mutable std::mutex blockMutex; // Protects BlockManager state and operations.
     #endif
@@ -0,0 +1,54 @@
+#ifndef IO_CONTEXT_H
+#define IO_CONTEXT_H
+
+#include "cstdint"
+
+namespace fs {
+
+// Foreground I/O is issued on behalf of a user request that is waiting for it. Background I/O is internal
+// housekeeping (checkpoints, recovery, cleaning, read-ahead) that can be deferred in favour of foreground work.
+enum class IoPriority : uint8_t {
+    IO_PRIORITY_FOREGROUND = 0,
+    IO_PRIORITY_BACKGROUND,
+};
+
+// Per-thread attributes of the block I/O currently being issued. The fs_req_* entry points set these for the
+// duration of a request so block-layer stages (QoS, scheduling) can tell whose I/O they are looking at
+// without every filesystem call having to pass it down.
+struct IoContext
+{
+    uint32_t tenant = 0; // client/tenant the I/O is charged to
+    IoPriority priority = IoPriority::IO_PRIORITY_FOREGROUND;
+};
+
+inline thread_local IoContext currentIoContext;
+
+// Sets the calling thread's I/O context for the lifetime of the scope and restores the previous one after.
+class IoContextScope
+{
+public:
+    explicit IoContextScope(const uint32_t tenant) : saved(currentIoContext)
+    {
+        currentIoContext.tenant = tenant;
+    }
+
+    explicit IoContextScope(const IoPriority priority) : saved(currentIoContext)
+    {
+        currentIoContext.priority = priority;
+    }
+
+    ~IoContextScope()
+    {
+        currentIoContext = saved;
+    }
+
+    IoContextScope(const IoContextScope&) = delete;
+    IoContextScope& operator=(const IoContextScope&) = delete;
+
+private:
+    IoContext saved;
+};
+
+} // namespace fs
+
+#endif // IO_CONTEXT_H
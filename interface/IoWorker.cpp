@@ -0,0 +1,64 @@
+#include "IoWorker.h"
+
+#ifdef NOT_KERNEL
+
+namespace fs {
+
+IoWorker::IoWorker() : thread(&IoWorker::run, this)
+{
+}
+
+IoWorker::~IoWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        stopping = true;
+    }
+    jobQueued.notify_one();
+    thread.join();
+}
+
+uint64_t IoWorker::submit(std::function<void()> job)
+{
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        jobs.push_back({currentIoContext, std::move(job)});
+        ticket = ++submitted;
+    }
+    jobQueued.notify_one();
+    return ticket;
+}
+
+void IoWorker::wait(const uint64_t ticket)
+{
+    std::unique_lock<std::mutex> lock(workerMutex);
+    jobDone.wait(lock, [&] { return completed >= ticket; });
+}
+
+void IoWorker::run()
+{
+    std::unique_lock<std::mutex> lock(workerMutex);
+    while (true)
+    {
+        jobQueued.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+        {
+            return;
+        }
+        queuedJob queued = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+        const IoContext saved = currentIoContext;
+        currentIoContext = queued.context;
+        queued.job();
+        currentIoContext = saved;
+        lock.lock();
+        completed++;
+        jobDone.notify_all();
+    }
+}
+
+} // namespace fs
+
+#endif // NOT_KERNEL
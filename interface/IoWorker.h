@@ -0,0 +1,59 @@
+#ifndef IO_WORKER_H
+#define IO_WORKER_H
+
+#ifdef NOT_KERNEL
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "IoContext.h"
+
+namespace fs {
+
+/**
+ * A long-lived thread that runs I/O jobs for one device in the order they were submitted. Block managers that
+ * span several devices hand it the transfer for one device while the calling thread drives another, so their
+ * latencies overlap without starting a thread per request.
+ */
+class IoWorker
+{
+public:
+    IoWorker();
+    ~IoWorker();
+
+    IoWorker(const IoWorker&) = delete;
+    IoWorker& operator=(const IoWorker&) = delete;
+
+    // Queues job and returns a ticket to wait on. The job may run before submit returns. It runs with the
+    // submitting thread's I/O context, so stages below see whose I/O it is.
+    uint64_t submit(std::function<void()> job);
+    // Returns once the job with this ticket, and so every job submitted before it, has run.
+    void wait(uint64_t ticket);
+
+private:
+    struct queuedJob
+    {
+        IoContext context;
+        std::function<void()> job;
+    };
+
+    void run();
+
+    std::mutex workerMutex;
+    std::condition_variable jobQueued;
+    std::condition_variable jobDone;
+    std::deque<queuedJob> jobs;
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    bool stopping = false;
+    std::thread thread; // last, so it starts once everything it uses is constructed
+};
+
+} // namespace fs
+
+#endif // NOT_KERNEL
+
+#endif // IO_WORKER_H
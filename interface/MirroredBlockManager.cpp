@@ -0,0 +1,138 @@
+#include "MirroredBlockManager.h"
+
+namespace fs {
+
+MirroredBlockManager::MirroredBlockManager(BlockManager* primary, BlockManager* secondary)
+    : BlockManager(static_cast<int>(std::min(primary->getNumBlocks(), secondary->getNumBlocks())))
+{
+    replicas[0].device = primary;
+    replicas[1].device = secondary;
+}
+
+size_t MirroredBlockManager::chooseReplica(const size_t blockIndex) const
+{
+    const uint32_t busy0 = replicas[0].inFlight.load();
+    const uint32_t busy1 = replicas[1].inFlight.load();
+    if (busy0 != busy1)
+    {
+        return busy0 < busy1 ? 0 : 1;
+    }
+    auto distance = [blockIndex](const size_t head)
+    {
+        return head > blockIndex ? head - blockIndex : blockIndex - head;
+    };
+    return distance(replicas[1].lastBlock.load()) < distance(replicas[0].lastBlock.load()) ? 1 : 0;
+}
+
+bool MirroredBlockManager::readFrom(const size_t replica, const size_t blockIndex, const size_t count,
+                                    uint8_t* buffer)
+{
+    auto& r = replicas[replica];
+    r.inFlight++;
+    const bool ok = count == 1
+                        ? r.device->readBlock(blockIndex, buffer)
+                        : r.device->readBlocks(blockIndex, count, buffer);
+    r.lastBlock = blockIndex + count;
+    r.inFlight--;
+    if (ok)
+    {
+        r.reads += count;
+    }
+    return ok;
+}
+
+bool MirroredBlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
+{
+    if (blockIndex >= getNumBlocks())
+    {
+        std::cerr << "readBlock: block index " << blockIndex << " is out of mirrored range.\n";
+        return false;
+    }
+    const size_t first = chooseReplica(blockIndex);
+    if (readFrom(first, blockIndex, 1, buffer))
+    {
+        return true;
+    }
+    std::cerr << "readBlock: replica " << first << " failed, retrying on the other replica.\n";
+    return readFrom(1 - first, blockIndex, 1, buffer);
+}
+
+bool MirroredBlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
+{
+    return writeBlocks(blockIndex, 1, buffer);
+}
+
+bool MirroredBlockManager::readBlocks(const size_t blockIndex, const size_t count, uint8_t* buffer)
+{
+    if (blockIndex + count > getNumBlocks())
+    {
+        std::cerr << "readBlocks: run is out of mirrored range.\n";
+        return false;
+    }
+    if (count < 2)
+    {
+        return count == 0 || readBlock(blockIndex, buffer);
+    }
+
+    // Each replica reads one half of the run.
+    const size_t first = chooseReplica(blockIndex);
+    const size_t half = count / 2;
+    bool ok[NUM_REPLICAS] = {false, false};
+    auto readHalf = [&](const size_t part)
+    {
+        const size_t start = part == 0 ? 0 : half;
+        const size_t n = part == 0 ? half : count - half;
+        const size_t replica = part == 0 ? first : 1 - first;
+        uint8_t* dst = buffer + start * BLOCK_SIZE;
+        ok[part] = readFrom(replica, blockIndex + start, n, dst) ||
+            readFrom(1 - replica, blockIndex + start, n, dst);
+    };
+
+#ifdef NOT_KERNEL
+    const uint64_t ticket = workers[1 - first].submit([&] { readHalf(1); });
+    readHalf(0);
+    workers[1 - first].wait(ticket);
+#else
+    readHalf(0);
+    readHalf(1);
+#endif
+    return ok[0] && ok[1];
+}
+
+bool MirroredBlockManager::writeBlocks(const size_t blockIndex, const size_t count, const uint8_t* buffer)
+{
+    if (blockIndex + count > getNumBlocks())
+    {
+        std::cerr << "writeBlocks: run is out of mirrored range.\n";
+        return false;
+    }
+
+    bool ok[NUM_REPLICAS] = {false, false};
+    auto writeReplica = [&](const size_t replica)
+    {
+        auto& r = replicas[replica];
+        r.inFlight++;
+        ok[replica] = count == 1
+                          ? r.device->writeBlock(blockIndex, buffer)
+                          : r.device->writeBlocks(blockIndex, count, buffer);
+        r.lastBlock = blockIndex + count;
+        r.inFlight--;
+    };
+
+#ifdef NOT_KERNEL
+    const uint64_t ticket = workers[1].submit([&] { writeReplica(1); });
+    writeReplica(0);
+    workers[1].wait(ticket);
+#else
+    writeReplica(0);
+    writeReplica(1);
+#endif
+    if (!ok[0] || !ok[1])
+    {
+        std::cerr << "writeBlocks: failed to write block run at " << blockIndex << " to every replica.\n";
+        return false;
+    }
+    return true;
+}
+
+} // namespace fs
@@ -0,0 +1,59 @@
+#ifndef MIRRORED_BLOCK_MANAGER_H
+#define MIRRORED_BLOCK_MANAGER_H
+
+#include "BlockManager.h"
+#include "IoWorker.h"
+#include "atomic"
+
+namespace fs {
+
+/**
+ * RAID-1 style block manager. Every block is written to both replicas; a read is served by whichever replica
+ * currently has the fewest requests in flight, and on a tie by the one whose last access was closest to the
+ * requested block (the replica whose head is "nearest"). A failed read is retried on the other replica.
+ * The calling thread drives one replica itself and hands the other replica's part of a request to that replica's
+ * worker thread.
+ */
+class MirroredBlockManager : public BlockManager
+{
+public:
+    /**
+     * Constructor.
+     * @param primary    First replica.
+     * @param secondary  Second replica. Both replicas must expose at least the same number of blocks as primary.
+     */
+    MirroredBlockManager(BlockManager* primary, BlockManager* secondary);
+
+    bool readBlock(size_t blockIndex, uint8_t* buffer) override;
+    bool writeBlock(size_t blockIndex, const uint8_t* buffer) override;
+
+    // A run is split in half, one half per replica, and both halves are read concurrently.
+    bool readBlocks(size_t blockIndex, size_t count, uint8_t* buffer) override;
+    bool writeBlocks(size_t blockIndex, size_t count, const uint8_t* buffer) override;
+
+    // Number of reads served by each replica so far.
+    uint64_t getReadCount(size_t replica) const { return replicas[replica].reads.load(); }
+
+private:
+    static constexpr size_t NUM_REPLICAS = 2;
+
+    struct replica
+    {
+        BlockManager* device;
+        std::atomic<uint32_t> inFlight{0};
+        std::atomic<size_t> lastBlock{0}; // block following the last access, i.e. where the head is now
+        std::atomic<uint64_t> reads{0};
+    };
+
+    size_t chooseReplica(size_t blockIndex) const;
+    bool readFrom(size_t replica, size_t blockIndex, size_t count, uint8_t* buffer);
+
+    replica replicas[NUM_REPLICAS];
+#ifdef NOT_KERNEL
+    IoWorker workers[NUM_REPLICAS];
+#endif
+};
+
+} // namespace fs
+
+#endif // MIRRORED_BLOCK_MANAGER_H
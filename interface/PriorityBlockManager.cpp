@@ -0,0 +1,87 @@
+#include "PriorityBlockManager.h"
+
+namespace fs {
+
+PriorityBlockManager::PriorityBlockManager(BlockManager* device, const std::chrono::milliseconds agingLimit)
+    : BlockManager(static_cast<int>(device->getNumBlocks())), device(device), agingLimit(agingLimit)
+{
+}
+
+PriorityBlockManager::Stats PriorityBlockManager::getStats() const
+{
+    std::lock_guard<std::mutex> lock(schedMutex);
+    return stats;
+}
+
+void PriorityBlockManager::admit()
+{
+    std::unique_lock<std::mutex> lock(schedMutex);
+    if (currentIoContext.priority == IoPriority::IO_PRIORITY_FOREGROUND)
+    {
+        foregroundActive++;
+        stats.foregroundOps++;
+        return;
+    }
+
+    stats.backgroundOps++;
+    if (foregroundActive == 0)
+    {
+        return;
+    }
+    stats.backgroundDeferred++;
+    if (!foregroundIdle.wait_for(lock, agingLimit, [this] { return foregroundActive == 0; }))
+    {
+        stats.backgroundAged++;
+    }
+}
+
+void PriorityBlockManager::complete()
+{
+    if (currentIoContext.priority != IoPriority::IO_PRIORITY_FOREGROUND)
+    {
+        return;
+    }
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(schedMutex);
+        idle = --foregroundActive == 0;
+    }
+    if (idle)
+    {
+        foregroundIdle.notify_all();
+    }
+}
+
+bool PriorityBlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
+{
+    admit();
+    const bool ok = device->readBlock(blockIndex, buffer);
+    complete();
+    return ok;
+}
+
+bool PriorityBlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
+{
+    admit();
+    const bool ok = device->writeBlock(blockIndex, buffer);
+    complete();
+    return ok;
+}
+
+bool PriorityBlockManager::readBlocks(const size_t blockIndex, const size_t count, uint8_t* buffer)
+{
+    admit();
+    const bool ok = device->readBlocks(blockIndex, count, buffer);
+    complete();
+    return ok;
+}
+
+bool PriorityBlockManager::writeBlocks(const size_t blockIndex, const size_t count, const uint8_t* buffer)
+{
+    admit();
+    const bool ok = device->writeBlocks(blockIndex, count, buffer);
+    complete();
+    return ok;
+}
+
+} // namespace fs
@@ -0,0 +1,60 @@
+#ifndef PRIORITY_BLOCK_MANAGER_H
+#define PRIORITY_BLOCK_MANAGER_H
+
+#include "BlockManager.h"
+#include "IoContext.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace fs {
+
+/**
+ * Serves foreground I/O ahead of background I/O (see IoPriority in the calling thread's IoContext).
+ * A background request is held back while any foreground request is waiting or in flight, so housekeeping
+ * such as checkpointing only uses the device when users are not. To keep background work from starving under
+ * a steady foreground load, a background request that has waited longer than the aging limit is let through
+ * regardless.
+ */
+class PriorityBlockManager : public BlockManager
+{
+public:
+    struct Stats
+    {
+        uint64_t foregroundOps = 0;
+        uint64_t backgroundOps = 0;
+        uint64_t backgroundDeferred = 0; // background requests that had to wait for foreground I/O
+        uint64_t backgroundAged = 0;     // background requests let through by aging
+    };
+
+    /**
+     * Constructor.
+     * @param device    The device to schedule I/O onto.
+     * @param agingLimit How long a background request may be held back before it is issued anyway.
+     */
+    explicit PriorityBlockManager(BlockManager* device,
+                                  std::chrono::milliseconds agingLimit = std::chrono::milliseconds(100));
+
+    bool readBlock(size_t blockIndex, uint8_t* buffer) override;
+    bool writeBlock(size_t blockIndex, const uint8_t* buffer) override;
+    bool readBlocks(size_t blockIndex, size_t count, uint8_t* buffer) override;
+    bool writeBlocks(size_t blockIndex, size_t count, const uint8_t* buffer) override;
+
+    Stats getStats() const;
+
+private:
+    void admit();
+    void complete();
+
+    BlockManager* device;
+    std::chrono::milliseconds agingLimit;
+
+    mutable std::mutex schedMutex;
+    std::condition_variable foregroundIdle;
+    uint32_t foregroundActive = 0; // foreground requests waiting for or holding the device
+    Stats stats;
+};
+
+} // namespace fs
+
+#endif // PRIORITY_BLOCK_MANAGER_H
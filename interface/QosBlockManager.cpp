@@ -0,0 +1,198 @@
+#include "QosBlockManager.h"
+
+namespace fs {
+
+QosBlockManager::QosBlockManager(BlockManager* device)
+    : BlockManager(static_cast<int>(device->getNumBlocks())), device(device)
+{
+}
+
+void QosBlockManager::setTenantLimits(const uint32_t tenant, const Limits& limits)
+{
+    std::lock_guard<std::mutex> lock(qosMutex);
+    auto& state = tenants[tenant];
+    state.limits = limits;
+    if (state.limits.burstOps == 0)
+    {
+        state.limits.burstOps = std::max<uint32_t>(limits.iops, 1);
+    }
+    if (state.limits.burstBytes == 0)
+    {
+        state.limits.burstBytes = std::max<uint64_t>(limits.bytesPerSecond, BLOCK_SIZE);
+    }
+    state.limited = limits.iops != 0 || limits.bytesPerSecond != 0;
+    // Start with full buckets.
+    state.opTokens = state.limits.burstOps;
+    state.byteTokens = static_cast<double>(state.limits.burstBytes);
+    state.lastRefill = now();
+}
+
+QosBlockManager::TenantStats QosBlockManager::getTenantStats(const uint32_t tenant) const
+{
+    std::lock_guard<std::mutex> lock(qosMutex);
+    const auto it = tenants.find(tenant);
+    if (it == tenants.end())
+    {
+        return TenantStats{};
+    }
+    TenantStats stats = it->second.stats;
+    // Counted from admission until tokens are granted, but the lock is only released while actually waiting.
+    stats.waiting = it->second.waiting;
+    return stats;
+}
+
+void QosBlockManager::refill(tenantState& state, const clock::time_point now)
+{
+    const double elapsed = std::chrono::duration<double>(now - state.lastRefill).count();
+    state.lastRefill = now;
+
+    // Tokens that do not fit in the tenant's bucket go to the spare pool for others to borrow. The pool is
+    // bounded by the bucket depth of the tenant that overflowed into it, so idle time cannot bank unbounded
+    // bursts.
+    if (state.limits.iops)
+    {
+        state.opTokens += elapsed * state.limits.iops;
+        if (state.opTokens > state.limits.burstOps)
+        {
+            spareOps = std::min<double>(spareOps + state.opTokens - state.limits.burstOps, state.limits.burstOps);
+            state.opTokens = state.limits.burstOps;
+        }
+    }
+    if (state.limits.bytesPerSecond)
+    {
+        const auto depth = static_cast<double>(state.limits.burstBytes);
+        state.byteTokens += elapsed * static_cast<double>(state.limits.bytesPerSecond);
+        if (state.byteTokens > depth)
+        {
+            spareBytes = std::min(spareBytes + state.byteTokens - depth, depth);
+            state.byteTokens = depth;
+        }
+    }
+}
+
+QosBlockManager::clock::duration QosBlockManager::timeUntilTokens(const tenantState& state, const double bytes) const
+{
+    double seconds = 0;
+    if (state.limits.iops && state.opTokens < 1)
+    {
+        seconds = std::max(seconds, (1 - state.opTokens) / state.limits.iops);
+    }
+    if (state.limits.bytesPerSecond && state.byteTokens < bytes)
+    {
+        seconds = std::max(seconds, (bytes - state.byteTokens) / static_cast<double>(state.limits.bytesPerSecond));
+    }
+    // Wake up periodically anyway: the device may have gone idle, which lets this request through.
+    seconds = std::min(std::max(seconds, 0.001), 0.1);
+    return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+void QosBlockManager::admit(const size_t blocks)
+{
+    std::unique_lock<std::mutex> lock(qosMutex);
+    auto& state = tenants[currentIoContext.tenant];
+    const double bytes = static_cast<double>(blocks * BLOCK_SIZE);
+    state.stats.ops++;
+    state.stats.bytes += blocks * BLOCK_SIZE;
+
+    if (state.limited)
+    {
+        // A run larger than the bucket depth only needs a full bucket, and then drives the bucket into debt.
+        const double byteNeed = std::min(bytes, static_cast<double>(state.limits.burstBytes));
+        const auto start = now();
+        bool waited = false;
+        state.waiting++;
+        totalWaiting++;
+        while (true)
+        {
+            const auto refillTime = now();
+            for (auto& entry : tenants)
+            {
+                if (entry.second.limited)
+                {
+                    refill(entry.second, refillTime);
+                }
+            }
+            const bool opsOk = !state.limits.iops || state.opTokens >= 1;
+            const bool bytesOk = !state.limits.bytesPerSecond || state.byteTokens >= byteNeed;
+            if (opsOk && bytesOk)
+            {
+                state.opTokens -= state.limits.iops ? 1 : 0;
+                state.byteTokens -= state.limits.bytesPerSecond ? bytes : 0;
+                break;
+            }
+            // Borrow whatever the tenant's own buckets are short of from the spare pool.
+            if ((opsOk || spareOps >= 1) && (bytesOk || spareBytes >= byteNeed))
+            {
+                if (opsOk) state.opTokens -= state.limits.iops ? 1 : 0;
+                else spareOps -= 1;
+                if (bytesOk) state.byteTokens -= state.limits.bytesPerSecond ? bytes : 0;
+                else spareBytes -= byteNeed;
+                state.stats.borrowedOps++;
+                break;
+            }
+            // Work conserving: nobody else wants the device, so holding this request back would only idle it.
+            const uint32_t others = totalWaiting + totalInFlight - state.waiting - state.inFlight;
+            if (others == 0)
+            {
+                state.opTokens = std::max(0.0, state.opTokens - 1);
+                state.byteTokens = std::max(0.0, state.byteTokens - bytes);
+                break;
+            }
+            waited = true;
+            tokensAvailable.wait_for(lock, timeUntilTokens(state, byteNeed));
+        }
+        state.waiting--;
+        totalWaiting--;
+        if (waited)
+        {
+            state.stats.throttledOps++;
+            state.stats.throttledTime += std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start);
+        }
+    }
+    state.inFlight++;
+    totalInFlight++;
+}
+
+void QosBlockManager::complete()
+{
+    {
+        std::lock_guard<std::mutex> lock(qosMutex);
+        tenants[currentIoContext.tenant].inFlight--;
+        totalInFlight--;
+    }
+    tokensAvailable.notify_all();
+}
+
+bool QosBlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
+{
+    admit(1);
+    const bool ok = device->readBlock(blockIndex, buffer);
+    complete();
+    return ok;
+}
+
+bool QosBlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
+{
+    admit(1);
+    const bool ok = device->writeBlock(blockIndex, buffer);
+    complete();
+    return ok;
+}
+
+bool QosBlockManager::readBlocks(const size_t blockIndex, const size_t count, uint8_t* buffer)
+{
+    admit(count);
+    const bool ok = device->readBlocks(blockIndex, count, buffer);
+    complete();
+    return ok;
+}
+
+bool QosBlockManager::writeBlocks(const size_t blockIndex, const size_t count, const uint8_t* buffer)
+{
+    admit(count);
+    const bool ok = device->writeBlocks(blockIndex, count, buffer);
+    complete();
+    return ok;
+}
+
+} // namespace fs
@@ -0,0 +1,91 @@
+#ifndef QOS_BLOCK_MANAGER_H
+#define QOS_BLOCK_MANAGER_H
+
+#include "BlockManager.h"
+#include "IoContext.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+namespace fs {
+
+/**
+ * Per-tenant I/O rate limiting in front of another BlockManager. Each tenant (taken from the calling
+ * thread's IoContext) has two token buckets, one for operations and one for bytes. A request that finds its
+ * buckets empty may still go ahead if
+ *   - the shared spare pool, filled by tokens other tenants could not hold, covers it (borrowing), or
+ *   - no other tenant has I/O waiting or in flight, since holding it back would only leave the device idle.
+ * Otherwise it waits for its buckets to refill.
+ */
+class QosBlockManager : public BlockManager
+{
+public:
+    struct Limits
+    {
+        uint32_t iops = 0;           // sustained operations per second, 0 = unlimited
+        uint64_t bytesPerSecond = 0; // sustained bandwidth, 0 = unlimited
+        uint32_t burstOps = 0;       // bucket depth in operations (defaults to one second's worth)
+        uint64_t burstBytes = 0;     // bucket depth in bytes (defaults to one second's worth)
+    };
+
+    struct TenantStats
+    {
+        uint64_t ops = 0;
+        uint64_t bytes = 0;
+        uint64_t borrowedOps = 0;  // requests admitted on spare tokens
+        uint64_t throttledOps = 0; // requests that had to wait
+        std::chrono::nanoseconds throttledTime{0};
+        uint32_t waiting = 0;      // requests waiting for tokens right now
+    };
+
+    explicit QosBlockManager(BlockManager* device);
+
+    // Limits for a tenant; tenants without limits are never throttled.
+    void setTenantLimits(uint32_t tenant, const Limits& limits);
+    TenantStats getTenantStats(uint32_t tenant) const;
+
+    bool readBlock(size_t blockIndex, uint8_t* buffer) override;
+    bool writeBlock(size_t blockIndex, const uint8_t* buffer) override;
+    bool readBlocks(size_t blockIndex, size_t count, uint8_t* buffer) override;
+    bool writeBlocks(size_t blockIndex, size_t count, const uint8_t* buffer) override;
+
+protected:
+    using clock = std::chrono::steady_clock;
+
+    // Time as the token buckets see it. Tests override it to refill buckets without waiting.
+    virtual clock::time_point now() const { return clock::now(); }
+
+private:
+    struct tenantState
+    {
+        Limits limits;
+        bool limited = false;
+        double opTokens = 0;
+        double byteTokens = 0;
+        clock::time_point lastRefill;
+        uint32_t waiting = 0;
+        uint32_t inFlight = 0;
+        TenantStats stats;
+    };
+
+    // Blocks until the calling tenant may issue an I/O of the given number of blocks.
+    void admit(size_t blocks);
+    void complete();
+    void refill(tenantState& state, clock::time_point now);
+    clock::duration timeUntilTokens(const tenantState& state, double bytes) const;
+
+    BlockManager* device;
+
+    mutable std::mutex qosMutex;
+    std::condition_variable tokensAvailable;
+    std::map<uint32_t, tenantState> tenants;
+    double spareOps = 0;
+    double spareBytes = 0;
+    uint32_t totalWaiting = 0;
+    uint32_t totalInFlight = 0;
+};
+
+} // namespace fs
+
+#endif // QOS_BLOCK_MANAGER_H
@@ -0,0 +1,193 @@
+#include "StripedBlockManager.h"
+#include "cstring"
+
+namespace fs {
+
+StripedBlockManager::StripedBlockManager(const std::vector<BlockManager*>& members, const uint32_t stripeUnit)
+    : BlockManager(computeNumBlocks(members, stripeUnit)), members(members), stripeUnit(stripeUnit)
+{
+    if (members.empty() || stripeUnit == 0)
+    {
+        std::cerr << "StripedBlockManager: need at least one member and a non-zero stripe unit.\n";
+    }
+#ifdef NOT_KERNEL
+    for (size_t m = 0; m < members.size(); m++)
+    {
+        workers.push_back(std::make_unique<IoWorker>());
+    }
+#endif
+}
+
+int StripedBlockManager::computeNumBlocks(const std::vector<BlockManager*>& members, const uint32_t stripeUnit)
+{
+    if (members.empty() || stripeUnit == 0)
+    {
+        return 0;
+    }
+    // Every member contributes the same number of whole stripe units, bounded by the smallest member.
+    uint32_t smallest = members[0]->getNumBlocks();
+    for (const auto* member : members)
+    {
+        smallest = std::min(smallest, member->getNumBlocks());
+    }
+    return static_cast<int>((smallest / stripeUnit) * stripeUnit * members.size());
+}
+
+void StripedBlockManager::mapBlock(const size_t blockIndex, size_t& member, size_t& memberBlock) const
+{
+    const size_t stripe = blockIndex / stripeUnit;
+    member = stripe % members.size();
+    memberBlock = (stripe / members.size()) * stripeUnit + blockIndex % stripeUnit;
+}
+
+bool StripedBlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
+{
+    if (blockIndex >= getNumBlocks())
+    {
+        std::cerr << "readBlock: block index " << blockIndex << " is out of striped range.\n";
+        return false;
+    }
+    size_t member, memberBlock;
+    mapBlock(blockIndex, member, memberBlock);
+    return members[member]->readBlock(memberBlock, buffer);
+}
+
+bool StripedBlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
+{
+    if (blockIndex >= getNumBlocks())
+    {
+        std::cerr << "writeBlock: block index " << blockIndex << " is out of striped range.\n";
+        return false;
+    }
+    size_t member, memberBlock;
+    mapBlock(blockIndex, member, memberBlock);
+    return members[member]->writeBlock(memberBlock, buffer);
+}
+
+bool StripedBlockManager::transferRun(const size_t blockIndex, const size_t count, uint8_t* buffer, const bool write)
+{
+    if (blockIndex + count > getNumBlocks())
+    {
+        std::cerr << "StripedBlockManager: run [" << blockIndex << ", " << blockIndex + count
+            << ") is out of striped range.\n";
+        return false;
+    }
+
+    struct chunk
+    {
+        size_t count;
+        size_t bufferOffset;
+    };
+    struct memberRun
+    {
+        size_t memberBlock = 0;
+        size_t count = 0;
+        std::vector<chunk> chunks; // where the member's blocks go in the caller's buffer, in member order
+    };
+    std::vector<memberRun> runs(members.size());
+
+    // Stripe units that land on the same member follow each other on that member, so every member's share of
+    // the run is one consecutive range there.
+    size_t cur = blockIndex;
+    const size_t end = blockIndex + count;
+    while (cur < end)
+    {
+        const size_t len = std::min<size_t>(stripeUnit - cur % stripeUnit, end - cur);
+        size_t member, memberBlock;
+        mapBlock(cur, member, memberBlock);
+        memberRun& run = runs[member];
+        if (run.chunks.empty())
+        {
+            run.memberBlock = memberBlock;
+        }
+        run.count += len;
+        run.chunks.push_back({len, (cur - blockIndex) * BLOCK_SIZE});
+        cur += len;
+    }
+
+    std::vector<char> ok(members.size(), 1);
+    auto runMember = [&](const size_t member)
+    {
+        const memberRun& run = runs[member];
+        BlockManager* device = members[member];
+        if (run.chunks.size() == 1)
+        {
+            uint8_t* data = buffer + run.chunks[0].bufferOffset;
+            ok[member] = write
+                             ? device->writeBlocks(run.memberBlock, run.count, data)
+                             : device->readBlocks(run.memberBlock, run.count, data);
+            return;
+        }
+        // Several stripe units: gather them for a write, or scatter them after a read.
+        std::vector<uint8_t> bounce(run.count * BLOCK_SIZE);
+        if (!write && !device->readBlocks(run.memberBlock, run.count, bounce.data()))
+        {
+            ok[member] = 0;
+            return;
+        }
+        size_t offset = 0;
+        for (const auto& c : run.chunks)
+        {
+            if (write)
+            {
+                std::memcpy(bounce.data() + offset, buffer + c.bufferOffset, c.count * BLOCK_SIZE);
+            }
+            else
+            {
+                std::memcpy(buffer + c.bufferOffset, bounce.data() + offset, c.count * BLOCK_SIZE);
+            }
+            offset += c.count * BLOCK_SIZE;
+        }
+        if (write)
+        {
+            ok[member] = device->writeBlocks(run.memberBlock, run.count, bounce.data());
+        }
+    };
+
+#ifdef NOT_KERNEL
+    // Overlap the device latency of the members; the calling thread takes the first member itself.
+    std::vector<std::pair<size_t, uint64_t>> tickets;
+    size_t first = members.size();
+    for (size_t m = 0; m < members.size(); m++)
+    {
+        if (runs[m].count == 0) continue;
+        if (first == members.size())
+        {
+            first = m;
+            continue;
+        }
+        tickets.emplace_back(m, workers[m]->submit([&runMember, m] { runMember(m); }));
+    }
+    if (first != members.size())
+    {
+        runMember(first);
+    }
+    for (const auto& ticket : tickets)
+    {
+        workers[ticket.first]->wait(ticket.second);
+    }
+#else
+    for (size_t m = 0; m < members.size(); m++)
+    {
+        if (runs[m].count != 0)
+        {
+            runMember(m);
+        }
+    }
+#endif
+
+    return std::all_of(ok.begin(), ok.end(), [](const char c) { return c != 0; });
+}
+
+bool StripedBlockManager::readBlocks(const size_t blockIndex, const size_t count, uint8_t* buffer)
+{
+    return transferRun(blockIndex, count, buffer, false);
+}
+
+bool StripedBlockManager::writeBlocks(const size_t blockIndex, const size_t count, const uint8_t* buffer)
+{
+    // Only read from when writing.
+    return transferRun(blockIndex, count, const_cast<uint8_t*>(buffer), true);
+}
+
+} // namespace fs
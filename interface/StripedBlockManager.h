@@ -0,0 +1,58 @@
+#ifndef STRIPED_BLOCK_MANAGER_H
+#define STRIPED_BLOCK_MANAGER_H
+
+#include "BlockManager.h"
+#include "IoWorker.h"
+#include "vector"
+#ifdef NOT_KERNEL
+#include "memory"
+#endif
+
+namespace fs {
+
+/**
+ * RAID-0 style block manager. Presents several member BlockManagers (partitions of one FakeDiskDriver or
+ * separate driver instances) as a single logical block space. Logical blocks are dealt out to the members
+ * in chunks of stripeUnit blocks, round robin, so a large transfer keeps every member busy at once. The calling
+ * thread drives one member itself and hands the others their part of a run through per-member worker threads.
+ */
+class StripedBlockManager : public BlockManager
+{
+public:
+    /**
+     * Constructor.
+     * @param members     The member block managers, in stripe order. Must not be empty.
+     * @param stripeUnit  Number of consecutive logical blocks placed on one member before moving to the next.
+     */
+    StripedBlockManager(const std::vector<BlockManager*>& members, uint32_t stripeUnit);
+
+    bool readBlock(size_t blockIndex, uint8_t* buffer) override;
+    bool writeBlock(size_t blockIndex, const uint8_t* buffer) override;
+
+    // Splits the run into one transfer per member and issues the members concurrently. The stripe units a run
+    // puts on one member are consecutive there, so they go through a bounce buffer as a single transfer.
+    bool readBlocks(size_t blockIndex, size_t count, uint8_t* buffer) override;
+    bool writeBlocks(size_t blockIndex, size_t count, const uint8_t* buffer) override;
+
+    uint32_t getStripeUnit() const { return stripeUnit; }
+    size_t getNumMembers() const { return members.size(); }
+
+private:
+    // Translates a logical block into (member, block within member).
+    void mapBlock(size_t blockIndex, size_t& member, size_t& memberBlock) const;
+
+    // Reads or writes (buffer is then only read) the logical run, one transfer per member that has part of it.
+    bool transferRun(size_t blockIndex, size_t count, uint8_t* buffer, bool write);
+
+    static int computeNumBlocks(const std::vector<BlockManager*>& members, uint32_t stripeUnit);
+
+    std::vector<BlockManager*> members;
+    uint32_t stripeUnit;
+#ifdef NOT_KERNEL
+    std::vector<std::unique_ptr<IoWorker>> workers; // one per member
+#endif
+};
+
+} // namespace fs
+
+#endif // STRIPED_BLOCK_MANAGER_H
@@ -0,0 +1,57 @@
+#include "TieredBlockManager.h"
+
+namespace fs {
+
+TieredBlockManager::TieredBlockManager(BlockManager* fast, BlockManager* slow)
+    : BlockManager(static_cast<int>(fast->getNumBlocks() + slow->getNumBlocks())), fast(fast), slow(slow)
+{
+}
+
+bool TieredBlockManager::readBlock(const size_t blockIndex, uint8_t* buffer)
+{
+    const size_t boundary = fast->getNumBlocks();
+    return blockIndex < boundary
+               ? fast->readBlock(blockIndex, buffer)
+               : slow->readBlock(blockIndex - boundary, buffer);
+}
+
+bool TieredBlockManager::writeBlock(const size_t blockIndex, const uint8_t* buffer)
+{
+    const size_t boundary = fast->getNumBlocks();
+    return blockIndex < boundary
+               ? fast->writeBlock(blockIndex, buffer)
+               : slow->writeBlock(blockIndex - boundary, buffer);
+}
+
+bool TieredBlockManager::readBlocks(const size_t blockIndex, const size_t count, uint8_t* buffer)
+{
+    const size_t boundary = fast->getNumBlocks();
+    if (blockIndex >= boundary)
+    {
+        return slow->readBlocks(blockIndex - boundary, count, buffer);
+    }
+    // A run that straddles the boundary is split into its fast and slow parts.
+    const size_t onFast = std::min(count, boundary - blockIndex);
+    if (!fast->readBlocks(blockIndex, onFast, buffer))
+    {
+        return false;
+    }
+    return onFast == count || slow->readBlocks(0, count - onFast, buffer + onFast * BLOCK_SIZE);
+}
+
+bool TieredBlockManager::writeBlocks(const size_t blockIndex, const size_t count, const uint8_t* buffer)
+{
+    const size_t boundary = fast->getNumBlocks();
+    if (blockIndex >= boundary)
+    {
+        return slow->writeBlocks(blockIndex - boundary, count, buffer);
+    }
+    const size_t onFast = std::min(count, boundary - blockIndex);
+    if (!fast->writeBlocks(blockIndex, onFast, buffer))
+    {
+        return false;
+    }
+    return onFast == count || slow->writeBlocks(0, count - onFast, buffer + onFast * BLOCK_SIZE);
+}
+
+} // namespace fs
@@ -0,0 +1,38 @@
+#ifndef TIERED_BLOCK_MANAGER_H
+#define TIERED_BLOCK_MANAGER_H
+
+#include "BlockManager.h"
+
+namespace fs {
+
+/**
+ * Concatenates a fast and a slow BlockManager into one logical block space: blocks [0, fastBlocks) live on
+ * the fast device and blocks [fastBlocks, fastBlocks + slowBlocks) on the slow one. The filesystem lays its
+ * metadata out below getFastTierBlocks() and its data region above it.
+ */
+class TieredBlockManager : public BlockManager
+{
+public:
+    /**
+     * Constructor.
+     * @param fast  Device holding the low end of the block space (superblock, bitmaps, inodes, log).
+     * @param slow  Device holding the high end of the block space (file data).
+     */
+    TieredBlockManager(BlockManager* fast, BlockManager* slow);
+
+    bool readBlock(size_t blockIndex, uint8_t* buffer) override;
+    bool writeBlock(size_t blockIndex, const uint8_t* buffer) override;
+    bool readBlocks(size_t blockIndex, size_t count, uint8_t* buffer) override;
+    bool writeBlocks(size_t blockIndex, size_t count, const uint8_t* buffer) override;
+
+    // First logical block that lives on the slow device.
+    uint32_t getFastTierBlocks() const { return fast->getNumBlocks(); }
+
+private:
+    BlockManager* fast;
+    BlockManager* slow;
+};
+
+} // namespace fs
+
+#endif // TIERED_BLOCK_MANAGER_H
@@ -4,13 +4,26 @@
 
 
 // test_fs.cpp
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <condition_variable>
 #include <cstdio>
+#include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
 
 #include "../interface/FakeDiskDriver.h"
 #include "../interface/BlockManager.h"
+#include "../interface/StripedBlockManager.h"
+#include "../interface/MirroredBlockManager.h"
+#include "../interface/TieredBlockManager.h"
+#include "../interface/QosBlockManager.h"
+#include "../interface/PriorityBlockManager.h"
+#include "../filesys/EpochManager.h"
 #include "../filesys/FileSystem.h"
 #include "../filesys/fs_requests.h"
 
@@ -43,6 +56,67 @@ static bool dirContains(inode_index_t dirInode, const char *name) {
 //     return false;
 // }
 
+// Byte-for-byte copy of a disk image, standing in for the state a crash would leave on disk.
+static void copyImage(const char *from, const char *to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    assert(in && out);
+    out << in.rdbuf();
+}
+
+// Zeroes blocks left over from an earlier run, so a bitmap or table built on them starts out empty.
+static void zeroBlocks(BlockManager &bm, block_index_t first, block_index_t count) {
+    block_t emptyBlock{};
+    for (block_index_t i = 0; i < count; i++) {
+        assert(bm.writeBlock(first + i, emptyBlock.data));
+    }
+}
+
+// An image with one partition over all of it and a block manager on that partition. The image is used as found,
+// so a copy taken with copyImage mounts with what it holds.
+struct TestDisk {
+    FakeDiskDriver disk;
+    BlockManager bm;
+
+    TestDisk(const char *image, size_t sectors, std::chrono::milliseconds latency = std::chrono::milliseconds(0))
+        : disk(image, sectors, latency), bm(disk, wholeDisk(disk, sectors), static_cast<int>(sectors / 8)) {
+    }
+
+private:
+    static FakeDiskDriver::Partition wholeDisk(FakeDiskDriver &disk, size_t sectors) {
+        assert(disk.createPartition(0, sectors, "ext4"));
+        return disk.listPartitions()[0];
+    }
+};
+
+// A new filesystem mounted on a TestDisk. Its superblock is zeroed first, so an image left over from an earlier
+// run is formatted again. Unmounting is up to the test.
+struct TestFileSystem : TestDisk {
+    TestFileSystem(const char *image, size_t sectors, const FileSystemOptions &options = {},
+                   std::chrono::milliseconds latency = std::chrono::milliseconds(0))
+        : TestDisk(image, sectors, latency) {
+        zeroBlocks(bm, 0, 1);
+        init(&bm, options);
+    }
+};
+
+// Reads the first nBytes of a file, the last of them a terminating null.
+static std::string readPath(const char *path, int nBytes) {
+    auto ro = fs_req_open(path);
+    assert(ro.status == FS_RESP_SUCCESS);
+    char buffer[256] = {};
+    auto rd = fs_req_read(ro.inode_index, buffer, 0, nBytes);
+    assert(rd.status == FS_RESP_SUCCESS);
+    return std::string(buffer, nBytes - 1);
+}
+
+// Mounts the image afresh and checks that /file2 holds msg.
+static void checkFile2AfterMount(BlockManager &bm, const char *msg, const FileSystemOptions &options = {}) {
+    init(&bm, options);
+    assert(readPath("/file2", std::strlen(msg) + 1) == msg);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
 static std::string readFile(inode_index_t inode, int nBytes) {
     // first open
     static char pathBuf[64];
@@ -58,9 +132,1100 @@ static std::string readFile(inode_index_t inode, int nBytes) {
     return std::string(buffer, nBytes - 1);
 }
 
+// Passes I/O through to another device, but reads wait while the gate is closed, so a test can keep a request in
+// flight for exactly as long as it needs to.
+class GatedBlockManager : public BlockManager {
+public:
+    explicit GatedBlockManager(BlockManager *device)
+        : BlockManager(static_cast<int>(device->getNumBlocks())), device(device) {}
+
+    bool readBlock(size_t blockIndex, uint8_t *buffer) override {
+        {
+            std::unique_lock<std::mutex> lock(gateMutex);
+            heldReads++;
+            gateChanged.notify_all();
+            gateChanged.wait(lock, [this] { return isOpen; });
+            heldReads--;
+        }
+        return device->readBlock(blockIndex, buffer);
+    }
+
+    bool writeBlock(size_t blockIndex, const uint8_t *buffer) override {
+        return device->writeBlock(blockIndex, buffer);
+    }
+
+    void setOpen(bool open) {
+        {
+            std::lock_guard<std::mutex> lock(gateMutex);
+            isOpen = open;
+        }
+        gateChanged.notify_all();
+    }
+
+    // Returns once a read is held at the closed gate.
+    void waitForHeldRead() {
+        std::unique_lock<std::mutex> lock(gateMutex);
+        gateChanged.wait(lock, [this] { return heldReads > 0; });
+    }
+
+private:
+    BlockManager *device;
+    std::mutex gateMutex;
+    std::condition_variable gateChanged;
+    bool isOpen = true;
+    int heldReads = 0;
+};
+
+// Striping across two partitions must round-trip single blocks and multi-block runs.
+static void testStripedBlockManager() {
+    FakeDiskDriver disk("test_stripe.img", 1024, std::chrono::milliseconds(0));
+    assert(disk.createPartition(0, 512, "stripe0"));
+    assert(disk.createPartition(512, 512, "stripe1"));
+    auto parts = disk.listPartitions();
+    BlockManager m0(disk, parts[0], 64);
+    BlockManager m1(disk, parts[1], 64);
+    StripedBlockManager striped({&m0, &m1}, 4);
+    assert(striped.getNumBlocks() == 128);
+
+    constexpr size_t RUN = 11;
+    static uint8_t out[RUN * BlockManager::BLOCK_SIZE];
+    static uint8_t in[RUN * BlockManager::BLOCK_SIZE];
+    for (size_t i = 0; i < RUN; i++) {
+        std::memset(out + i * BlockManager::BLOCK_SIZE, 'A' + i, BlockManager::BLOCK_SIZE);
+    }
+    assert(striped.writeBlocks(3, RUN, out));
+    assert(striped.readBlocks(3, RUN, in));
+    assert(std::memcmp(in, out, sizeof(out)) == 0);
+
+    // Logical block 4 starts the second stripe unit, which lives at block 0 of the second member.
+    uint8_t block[BlockManager::BLOCK_SIZE];
+    assert(m1.readBlock(0, block));
+    assert(block[0] == 'A' + 1);
+    // The first member holds stripe units 0 and 2 of the run back to back, written as one transfer.
+    assert(m0.readBlock(3, block) && block[0] == 'A');
+    assert(m0.readBlock(4, block) && block[0] == 'A' + 5);
+    assert(striped.readBlock(13, block));
+    assert(block[0] == 'A' + 10);
+}
+
+// Mirroring must put every write on both replicas and spread a multi-block read across them.
+static void testMirroredBlockManager() {
+    FakeDiskDriver disk("test_mirror.img", 1024, std::chrono::milliseconds(0));
+    assert(disk.createPartition(0, 512, "mirror0"));
+    assert(disk.createPartition(512, 512, "mirror1"));
+    auto parts = disk.listPartitions();
+    BlockManager r0(disk, parts[0], 64);
+    BlockManager r1(disk, parts[1], 64);
+    MirroredBlockManager mirrored(&r0, &r1);
+    assert(mirrored.getNumBlocks() == 64);
+
+    constexpr size_t RUN = 6;
+    static uint8_t out[RUN * BlockManager::BLOCK_SIZE];
+    static uint8_t in[RUN * BlockManager::BLOCK_SIZE];
+    for (size_t i = 0; i < RUN; i++) {
+        std::memset(out + i * BlockManager::BLOCK_SIZE, 'a' + i, BlockManager::BLOCK_SIZE);
+    }
+    assert(mirrored.writeBlocks(10, RUN, out));
+
+    uint8_t block[BlockManager::BLOCK_SIZE];
+    assert(r0.readBlock(15, block) && block[0] == 'a' + 5);
+    assert(r1.readBlock(15, block) && block[0] == 'a' + 5);
+
+    assert(mirrored.readBlocks(10, RUN, in));
+    assert(std::memcmp(in, out, sizeof(out)) == 0);
+    assert(mirrored.getReadCount(0) > 0 && mirrored.getReadCount(1) > 0);
+}
+
+// A run straddling the fast/slow boundary must be split between the two devices.
+static void testTieredBlockManager() {
+    FakeDiskDriver fastDisk("test_fast.img", 256, std::chrono::milliseconds(0));
+    FakeDiskDriver slowDisk("test_slow.img", 512, std::chrono::milliseconds(0));
+    assert(fastDisk.createPartition(0, 256, "meta"));
+    assert(slowDisk.createPartition(0, 512, "data"));
+    BlockManager fast(fastDisk, fastDisk.listPartitions()[0], 32);
+    BlockManager slow(slowDisk, slowDisk.listPartitions()[0], 64);
+    TieredBlockManager tiered(&fast, &slow);
+    assert(tiered.getNumBlocks() == 96 && tiered.getFastTierBlocks() == 32);
+
+    static uint8_t out[2 * BlockManager::BLOCK_SIZE];
+    std::memset(out, 'f', BlockManager::BLOCK_SIZE);
+    std::memset(out + BlockManager::BLOCK_SIZE, 's', BlockManager::BLOCK_SIZE);
+    assert(tiered.writeBlocks(31, 2, out));
+
+    uint8_t block[BlockManager::BLOCK_SIZE];
+    assert(fast.readBlock(31, block) && block[0] == 'f');
+    assert(slow.readBlock(0, block) && block[0] == 's');
+}
+
+// QoS stage whose token buckets refill only when the test advances the clock.
+class ManualClockQos : public QosBlockManager {
+public:
+    using QosBlockManager::QosBlockManager;
+
+    void advance(std::chrono::milliseconds by) {
+        elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(by).count();
+    }
+
+protected:
+    clock::time_point now() const override {
+        return clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(elapsed.load())));
+    }
+
+private:
+    std::atomic<int64_t> elapsed{0};
+};
+
+// A rate-limited tenant runs unthrottled while alone, but waits for tokens while another tenant is busy: until the
+// other tenant's request completes, or until its bucket has refilled.
+static void testQosBlockManager() {
+    TestDisk image("test_qos.img", 512);
+    GatedBlockManager gated(&image.bm);
+    ManualClockQos qos(&gated);
+    QosBlockManager::Limits limits;
+    limits.iops = 20;
+    limits.burstOps = 1;
+    qos.setTenantLimits(1, limits);
+
+    uint8_t block[BlockManager::BLOCK_SIZE] = {};
+    {
+        IoContextScope scope(1);
+        for (int i = 0; i < 5; i++) {
+            assert(qos.writeBlock(i, block));
+        }
+    }
+    assert(qos.getTenantStats(1).throttledOps == 0);
+
+    // Tenant 2 keeps a read in flight while tenant 1, out of tokens, writes.
+    auto holdOtherTenantRead = [&]() {
+        gated.setOpen(false);
+        std::thread reader([&qos] {
+            IoContextScope scope(2);
+            uint8_t buf[BlockManager::BLOCK_SIZE];
+            assert(qos.readBlock(10, buf));
+        });
+        gated.waitForHeldRead();
+        return reader;
+    };
+    auto startWrite = [&]() {
+        std::thread writer([&qos, &block] {
+            IoContextScope scope(1);
+            assert(qos.writeBlock(0, block));
+        });
+        while (qos.getTenantStats(1).waiting == 0) {
+            std::this_thread::yield();
+        }
+        return writer;
+    };
+
+    std::thread reader = holdOtherTenantRead();
+    std::thread writer = startWrite();
+    gated.setOpen(true);
+    reader.join();
+    writer.join();
+    assert(qos.getTenantStats(1).throttledOps == 1);
+
+    reader = holdOtherTenantRead();
+    writer = startWrite();
+    qos.advance(std::chrono::milliseconds(1000 / limits.iops));
+    writer.join();
+    assert(qos.getTenantStats(1).throttledOps == 2);
+    gated.setOpen(true);
+    reader.join();
+    assert(qos.getTenantStats(2).throttledOps == 0);
+    assert(qos.getTenantStats(1).waiting == 0);
+}
+
+// Background I/O waits for in-flight foreground I/O, but aging lets it through eventually. A foreground read held
+// in the device keeps the foreground busy for as long as the test needs.
+static void testPriorityBlockManager() {
+    TestDisk image("test_prio.img", 512);
+    GatedBlockManager gated(&image.bm);
+    uint8_t block[BlockManager::BLOCK_SIZE] = {};
+    auto holdForegroundRead = [&](PriorityBlockManager &sched) {
+        gated.setOpen(false);
+        std::thread reader([&sched] {
+            uint8_t buf[BlockManager::BLOCK_SIZE];
+            assert(sched.readBlock(1, buf));
+        });
+        gated.waitForHeldRead();
+        return reader;
+    };
+    auto writeInBackground = [&](PriorityBlockManager &sched) {
+        return std::thread([&sched, &block] {
+            IoContextScope scope(IoPriority::IO_PRIORITY_BACKGROUND);
+            assert(sched.writeBlock(20, block));
+        });
+    };
+
+    // Alone, background I/O goes straight through.
+    PriorityBlockManager sched(&gated, std::chrono::hours(1));
+    writeInBackground(sched).join();
+    assert(sched.getStats().backgroundDeferred == 0);
+
+    // With a foreground read in flight it waits, and goes once the read completes.
+    std::thread reader = holdForegroundRead(sched);
+    std::thread writer = writeInBackground(sched);
+    while (sched.getStats().backgroundDeferred == 0) {
+        std::this_thread::yield();
+    }
+    gated.setOpen(true);
+    reader.join();
+    writer.join();
+    auto stats = sched.getStats();
+    assert(stats.foregroundOps == 1 && stats.backgroundOps == 2);
+    assert(stats.backgroundDeferred == 1 && stats.backgroundAged == 0);
+
+    // Once it has waited out the aging limit (none here), it goes even though the read is still in flight.
+    PriorityBlockManager impatient(&gated, std::chrono::milliseconds(0));
+    reader = holdForegroundRead(impatient);
+    writeInBackground(impatient).join();
+    stats = impatient.getStats();
+    assert(stats.backgroundDeferred == 1 && stats.backgroundAged == 1);
+    gated.setOpen(true);
+    reader.join();
+}
+
+// The superblock keeps the last NUM_CHECKPOINTS checkpoints in a ring; mounting must find the latest one however
+// many times the ring has wrapped, and replay what was logged after it.
+static void testManyCheckpoints() {
+    TestFileSystem image("test_ckpt.img", 8192);
+
+    inode_index_t inode = fs_req_create_file(0, false, "file2", 0).inode_index;
+    assert(inode != INODE_NULL_VALUE);
+    for (uint32_t i = 0; i < NUM_CHECKPOINTS + 10; i++) {
+        assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    }
+    assert(fileSystem->getSuperBlock()->latestCheckpointIndex > NUM_CHECKPOINTS);
+    const char *msg = "after the last checkpoint";
+    assert(fs_req_write(inode, msg, 0, std::strlen(msg) + 1).status == FS_RESP_SUCCESS);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+    checkFile2AfterMount(image.bm, msg);
+}
+
+// A mounted snapshot outlives its checkpoint's place in the superblock. Its blocks stay allocated while it is
+// mounted and are freed by the first checkpoint after it is unmounted, or by unmounting the filesystem.
+static void testPinnedSnapshotEviction() {
+    TestFileSystem image("test_pin.img", 8192);
+
+    inode_index_t inode = fs_req_create_file(0, false, "file2", 0).inode_index;
+    assert(fs_req_write(inode, "pinned", 0, 7).status == FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    const uint32_t pinned = fileSystem->getSuperBlock()->latestCheckpointIndex;
+    assert(fs_req_write(inode, "live", 0, 5).status == FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+
+    // Checkpoint requests are refused while a snapshot is mounted, so take them directly.
+    auto evictPinned = [&]() {
+        assert(fs_req_mount_snapshot(pinned).status == FS_RESP_SUCCESS);
+        for (uint32_t i = 0; i < NUM_CHECKPOINTS; i++) {
+            assert(fileSystem->createCheckpoint());
+        }
+        assert(fileSystem->getSuperBlock()->latestCheckpointIndex - pinned >= NUM_CHECKPOINTS);
+        assert(readPath("/file2", 7) == "pinned");
+    };
+
+    evictPinned();
+    // Once the snapshot is unmounted, one checkpoint replaces another as usual, and the pinned one goes as well.
+    const uint64_t freeWhilePinned = fs_req_statfs().free_blocks;
+    assert(fs_req_mount_snapshot(0).status == FS_RESP_SUCCESS);
+    assert(fs_req_mount_snapshot(pinned).status != FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    assert(fs_req_statfs().free_blocks > freeWhilePinned);
+    assert(readPath("/file2", 5) == "live");
+
+    // A snapshot still mounted at unmount is dropped then.
+    assert(fs_req_write(inode, "pinned", 0, 7).status == FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    const uint32_t second = fileSystem->getSuperBlock()->latestCheckpointIndex;
+    assert(fs_req_write(inode, "live", 0, 5).status == FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    assert(fs_req_mount_snapshot(second).status == FS_RESP_SUCCESS);
+    for (uint32_t i = 0; i < NUM_CHECKPOINTS; i++) {
+        assert(fileSystem->createCheckpoint());
+    }
+    assert(readPath("/file2", 7) == "pinned");
+    const uint64_t freeAtUnmount = fs_req_statfs().free_blocks;
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+    init(&image.bm);
+    assert(fs_req_statfs().free_blocks > freeAtUnmount);
+    assert(readPath("/file2", 5) == "live");
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// Checkpoints taken by the background checkpointer alone keep the log short, and what was logged after the last
+// one is replayed at the next mount.
+static void testBackgroundCheckpointer() {
+    FileSystemOptions options;
+    options.logBlockCount = 4;
+    options.checkpointPolicy.replayRecords = 16;
+    TestFileSystem image("test_bgcp.img", 8192, options);
+
+    const uint32_t initial = fileSystem->getSuperBlock()->latestCheckpointIndex;
+    for (int i = 0; i < 40; i++) {
+        assert(fs_req_create_file(0, false, "bg" + std::to_string(i), 0).status == FS_RESP_SUCCESS);
+    }
+    // The checkpointer runs on its own thread; give it time to catch up.
+    for (int waited = 0; fs_req_list_checkpoints().num_checkpoints == initial && waited < 5000; waited++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(fs_req_list_checkpoints().num_checkpoints > initial);
+    assert(fs_req_create_file(0, false, "last", 0).status == FS_RESP_SUCCESS);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+    init(&image.bm, options);
+    for (int i = 0; i < 40; i++) {
+        assert(fs_req_open("/bg" + std::to_string(i)).status == FS_RESP_SUCCESS);
+    }
+    assert(fs_req_open("/last").status == FS_RESP_SUCCESS);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// Rewriting or deleting a file releases the inode slot it leaves behind, so without checkpoints holding on to
+// old versions the number of slots in use stays bounded however many times a file is replaced.
+static void testInodeSlotsReused() {
+    TestFileSystem image("test_slots.img", 65536);
+
+    const inode_index_t inode = fs_req_create_file(0, false, "file2", 0).inode_index;
+    assert(inode != INODE_NULL_VALUE);
+    const uint64_t before = fs_req_statfs().free_inodes;
+    uint64_t lowest = before;
+    for (int i = 0; i < 1000; i++) {
+        assert(fs_req_write(inode, "rewrite", 0, 8).status == FS_RESP_SUCCESS);
+        lowest = std::min<uint64_t>(lowest, fs_req_statfs().free_inodes);
+    }
+    for (int i = 0; i < 1000; i++) {
+        const auto created = fs_req_create_file(0, false, "tmp", 0);
+        assert(created.status == FS_RESP_SUCCESS);
+        assert(fs_req_remove_file(0, "tmp").status == FS_RESP_SUCCESS);
+        lowest = std::min<uint64_t>(lowest, fs_req_statfs().free_inodes);
+    }
+    // Freed slots go back to the bitmap in batches, once no lock-free reader can still be using them.
+    assert(before - lowest < 256);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// The log is a ring: running it past its size forces checkpoints that let it wrap, and both a clean remount and
+// one that has to scan for the end of the log still find everything.
+static void testLogWrap() {
+    FileSystemOptions options;
+    options.logBlockCount = 3;
+    TestFileSystem image("test_wrap.img", 65536, options);
+
+    const inode_index_t inode = fs_req_create_file(0, false, "file2", 0).inode_index;
+    const uint32_t initial = fileSystem->getSuperBlock()->latestCheckpointIndex;
+    char msg[32];
+    const int writes = 4 * options.logBlockCount * NUM_LOGRECORDS_PER_LOGENTRY;
+    for (int i = 0; i < writes; i++) {
+        std::snprintf(msg, sizeof(msg), "write %d", i);
+        assert(fs_req_write(inode, msg, 0, std::strlen(msg) + 1).status == FS_RESP_SUCCESS);
+    }
+    assert(fileSystem->getSuperBlock()->latestCheckpointIndex > initial);
+    assert(fs_req_log_stats().records > options.logBlockCount * NUM_LOGRECORDS_PER_LOGENTRY);
+
+    image.disk.flush();
+    copyImage("test_wrap.img", "test_wrap_crash.img");
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+    checkFile2AfterMount(image.bm, msg, options);
+
+    TestDisk crash("test_wrap_crash.img", 65536);
+    checkFile2AfterMount(crash.bm, msg, options);
+}
+
+// Writers on several threads share log block writes, and fs_req_sync makes everything they logged durable: a copy
+// of the disk taken right after it mounts with every write in place, with or without a commit interval.
+static void testGroupCommit(uint32_t commitIntervalMs) {
+    FileSystemOptions options;
+    options.logCommitIntervalMs = commitIntervalMs;
+    TestFileSystem image("test_group.img", 65536, options, std::chrono::milliseconds(1));
+
+    constexpr int THREADS = 8;
+    constexpr int WRITES = 20;
+    inode_index_t files[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        auto r = fs_req_create_file(0, false, "group" + std::to_string(t), 0);
+        assert(r.status == FS_RESP_SUCCESS);
+        files[t] = r.inode_index;
+    }
+    const auto before = fs_req_log_stats();
+    std::vector<std::thread> writers;
+    for (int t = 0; t < THREADS; t++) {
+        writers.emplace_back([&files, t]() {
+            for (int i = 0; i < WRITES; i++) {
+                assert(fs_req_write(files[t], "xy", 2 * i, 2).status == FS_RESP_SUCCESS);
+            }
+        });
+    }
+    for (auto &writer : writers) {
+        writer.join();
+    }
+    assert(fs_req_sync().status == FS_RESP_SUCCESS);
+    const auto after = fs_req_log_stats();
+    assert(after.records - before.records >= THREADS * WRITES);
+    assert(after.commits - before.commits < after.records - before.records);
+
+    image.disk.flush();
+    copyImage("test_group.img", "test_group_crash.img");
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+    TestDisk crash("test_group_crash.img", 65536);
+    init(&crash.bm, options);
+    for (int t = 0; t < THREADS; t++) {
+        auto ro = fs_req_open("/group" + std::to_string(t));
+        assert(ro.status == FS_RESP_SUCCESS);
+        char buffer[2 * WRITES] = {};
+        assert(fs_req_read(ro.inode_index, buffer, 0, 2 * WRITES).status == FS_RESP_SUCCESS);
+        for (int i = 0; i < WRITES; i++) {
+            assert(buffer[2 * i] == 'x' && buffer[2 * i + 1] == 'y');
+        }
+    }
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// The bitmap keeps a free count per bitmap block, so a search skips a full block without scanning its words, and
+// bits past the bitmap's size are never handed out.
+static void testBitmapSummaries() {
+    TestDisk image("test_bitmap.img", 8192);
+    zeroBlocks(image.bm, 1, 2);
+    constexpr block_index_t BITS = BitmapManager::BITS_PER_BLOCK;
+
+    BitmapManager bitmap(1, 2, 2 * BITS, &image.bm);
+    assert(bitmap.getFreeCount() == 2 * BITS);
+    assert(bitmap.setAllocatedRange(0, BITS));
+    assert(bitmap.getFreeCount(0) == 0 && bitmap.getFreeCount(1) == BITS);
+    assert(bitmap.getFreeCount() == BITS);
+    assert(bitmap.findNextFree(0) == BITS);
+    assert(bitmap.setUnallocated(100));
+    assert(bitmap.getFreeCount(0) == 1 && bitmap.getFreeCount() == BITS + 1);
+    assert(bitmap.findNextFree(0) == 100);
+
+    BitmapManager small(1, 1, 100, &image.bm);
+    assert(small.getFreeCount() == 100);
+    assert(small.setAllocatedRange(0, 99));
+    assert(small.findNextFree(0) == 99);
+    assert(small.setAllocated(99));
+    assert(small.getFreeCount() == 0);
+    assert(small.findNextFree(0) == NULL_INDEX);
+}
+
+// findNextFree scans a word at a time: runs of allocated bits may cross word and bitmap block boundaries, and a
+// search with nothing free after its goal wraps around to the start.
+static void testBitmapWordScan() {
+    TestDisk image("test_bitmap.img", 8192);
+    zeroBlocks(image.bm, 1, 2);
+    constexpr block_index_t BITS = BitmapManager::BITS_PER_BLOCK;
+
+    BitmapManager bitmap(1, 2, 2 * BITS, &image.bm);
+    assert(bitmap.setAllocatedRange(0, 130));
+    assert(bitmap.findNextFree(0) == 130);
+    assert(bitmap.setAllocatedRange(130, BITS));
+    assert(bitmap.findNextFree(0) == BITS + 130);
+    assert(bitmap.setAllocatedRange(2 * BITS - 64, 64));
+    assert(bitmap.findNextFree(2 * BITS - 64) == BITS + 130);
+    assert(bitmap.setUnallocated(63));
+    assert(bitmap.findNextFree(2 * BITS - 64) == 63);
+    assert(bitmap.findNextFree(64) == BITS + 130);
+}
+
+// findFreeRange returns the first run of the full count, and otherwise the longest run found that still has
+// minCount bits; allocateRange claims what it returns.
+static void testBitmapRanges() {
+    TestDisk image("test_bitmap.img", 8192);
+    zeroBlocks(image.bm, 1, 1);
+    constexpr block_index_t BITS = BitmapManager::BITS_PER_BLOCK;
+
+    BitmapManager bitmap(1, 1, BITS, &image.bm);
+    assert(bitmap.setAllocatedRange(0, BITS));
+    assert(bitmap.setUnallocatedRange(100, 3));
+    assert(bitmap.setUnallocatedRange(200, 6));
+    assert(bitmap.setUnallocatedRange(300, 12));
+    block_index_t found = 0;
+    assert(bitmap.findFreeRange(5, 5, found, 0) == 200 && found == 5);
+    assert(bitmap.findFreeRange(10, 10, found, 0) == 300 && found == 10);
+    assert(bitmap.findFreeRange(20, 5, found, 0) == 300 && found == 12);
+    assert(bitmap.findFreeRange(20, 13, found, 0) == NULL_INDEX);
+    assert(bitmap.allocateRange(20, 4, found, 0) == 300 && found == 12);
+    assert(bitmap.getFreeCount() == 9);
+    assert(bitmap.allocateRange(20, 4, found, 0) == 200 && found == 6);
+    assert(bitmap.allocateRange(20, 4, found, 0) == NULL_INDEX);
+}
+
+// A file written in one request gets its blocks as one contiguous extent.
+static void testContiguousFileBlocks() {
+    TestFileSystem image("test_extent.img", 8192);
+
+    const inode_index_t inode = fs_req_create_file(0, false, "extent", 0).inode_index;
+    static char data[8 * BlockManager::BLOCK_SIZE];
+    std::memset(data, 'e', sizeof(data));
+    assert(fs_req_write(inode, data, 0, sizeof(data)).status == FS_RESP_SUCCESS);
+    inode_index_t location;
+    inode_t contents;
+    assert(fileSystem->inodeTable->readInodeByNumber(inode, location, contents));
+    assert(contents.blockCount == 8);
+    for (int i = 1; i < 8; i++) {
+        assert(contents.directBlocks[i] == contents.directBlocks[0] + i);
+    }
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// Searches start at the goal, so a free bit at or after it wins over any before it. Goals are in the bitmap's
+// index space, which for the block bitmap starts at the data region.
+static void testBitmapGoal() {
+    TestDisk image("test_bitmap.img", 8192);
+    zeroBlocks(image.bm, 1, 2);
+    constexpr block_index_t BITS = BitmapManager::BITS_PER_BLOCK;
+    constexpr block_index_t OFFSET = 100;
+
+    BitmapManager bitmap(1, 2, 2 * BITS, &image.bm, OFFSET);
+    assert(bitmap.findNextFree(OFFSET + 5000) == OFFSET + 5000);
+    assert(bitmap.setAllocatedRange(OFFSET + 5000, 10));
+    assert(bitmap.findNextFree(OFFSET + 5000) == OFFSET + 5010);
+    assert(bitmap.findNextFree(OFFSET + BITS + 1) == OFFSET + BITS + 1);
+    block_index_t found = 0;
+    assert(bitmap.findFreeRange(8, 8, found, OFFSET + 7000) == OFFSET + 7000 && found == 8);
+    assert(bitmap.findFreeAligned(16, OFFSET + 7040) == OFFSET + 7040);
+    assert(bitmap.setAllocated(OFFSET + 7041));
+    assert(bitmap.findFreeAligned(16, OFFSET + 7040) == OFFSET + 7056);
+    // A goal outside the bitmap is ignored rather than trusted.
+    assert(bitmap.findNextFree(OFFSET - 1) != NULL_INDEX);
+}
+
+// A device larger than a block group is split into several groups at mkfs; usage counts cover all of them and
+// survive a remount.
+static void testBlockGroups() {
+    constexpr block_index_t BLOCKS = 2 * BLOCKS_PER_GROUP + 4096;
+    FileSystemOptions options;
+    options.blockGroups = true;
+    TestFileSystem image("test_groups.img", BLOCKS * 8, options);
+
+    const superBlock_t *sb = fileSystem->getSuperBlock();
+    assert(sb->blockGroupCount == 3);
+    const auto before = fs_req_statfs();
+    assert(before.total_inodes == sb->blockGroupCount * sb->inodesPerGroup);
+    // Each group's bitmaps and inode blocks are not counted as data blocks.
+    assert(before.total_blocks == sb->dataBlockCount - sb->blockGroupCount * (2 + sb->inodeRegionSize));
+    assert(before.free_blocks <= before.total_blocks);
+    static char data[4 * BlockManager::BLOCK_SIZE];
+    std::memset(data, 'g', sizeof(data));
+    for (int i = 0; i < 4; i++) {
+        const inode_index_t inode = fs_req_create_file(0, false, "grp" + std::to_string(i), 0).inode_index;
+        assert(inode != INODE_NULL_VALUE);
+        assert(fs_req_write(inode, data, 0, sizeof(data)).status == FS_RESP_SUCCESS);
+    }
+    const auto after = fs_req_statfs();
+    assert(after.free_blocks <= before.free_blocks - 16);
+    assert(after.free_inodes < before.free_inodes);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+    init(&image.bm, options);
+    const auto remounted = fs_req_statfs();
+    assert(remounted.free_blocks == after.free_blocks);
+    // Superseded inode slots still waiting for readers to finish with them are freed by the unmount.
+    assert(remounted.free_inodes >= after.free_inodes && remounted.free_inodes < before.free_inodes);
+    for (int i = 0; i < 4; i++) {
+        const auto ro = fs_req_open("/grp" + std::to_string(i));
+        assert(ro.status == FS_RESP_SUCCESS);
+        char buffer[16] = {};
+        assert(fs_req_read(ro.inode_index, buffer, 3 * BlockManager::BLOCK_SIZE, sizeof(buffer)).status == FS_RESP_SUCCESS);
+        assert(buffer[0] == 'g' && buffer[15] == 'g');
+    }
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// Bitmap changes stay in memory until flush() writes the modified blocks back; a bitmap loaded from disk sees
+// them only after that.
+static void testBitmapFlush() {
+    TestDisk image("test_bitmap.img", 8192);
+    zeroBlocks(image.bm, 1, 3);
+    constexpr block_index_t BITS = BitmapManager::BITS_PER_BLOCK;
+
+    BitmapManager bitmap(1, 3, 3 * BITS, &image.bm);
+    assert(bitmap.setAllocated(5));
+    assert(bitmap.setAllocatedRange(2 * BITS, 7));
+    {
+        BitmapManager loaded(1, 3, 3 * BITS, &image.bm);
+        assert(loaded.getFreeCount() == 3 * BITS);
+    }
+    assert(bitmap.flush());
+    {
+        BitmapManager loaded(1, 3, 3 * BITS, &image.bm);
+        assert(loaded.getFreeCount() == 3 * BITS - 8);
+        assert(loaded.getFreeCount(1) == BITS);
+        assert(loaded.findNextFree(5) == 6);
+        assert(loaded.findNextFree(2 * BITS) == 2 * BITS + 7);
+    }
+    // A change made after a flush goes out with the next one.
+    assert(bitmap.setUnallocated(5));
+    assert(bitmap.flush());
+    BitmapManager loaded(1, 3, 3 * BITS, &image.bm);
+    assert(loaded.findNextFree(0) == 0 && loaded.findNextFree(5) == 5);
+}
+
+// The inode map is updated in memory; a table loaded from disk sees the changes only once flush() has written
+// the modified table blocks.
+static void testInodeMapFlush() {
+    TestDisk image("test_imap.img", 8192);
+    assert(InodeTable::initialize(2, 2, &image.bm));
+    constexpr inode_index_t SIZE = 2 * TABLE_ENTRIES_PER_BLOCK;
+
+    InodeTable table(2, 2, SIZE, 10, &image.bm);
+    assert(table.setInodeLocation(3, 40));
+    assert(table.setInodeLocation(TABLE_ENTRIES_PER_BLOCK + 1, 41));
+    assert(table.getInodeLocation(3) == 40);
+    {
+        InodeTable loaded(2, 2, SIZE, 10, &image.bm);
+        assert(loaded.getInodeLocation(3) == INODE_NULL_VALUE);
+    }
+    assert(table.flush());
+    {
+        InodeTable loaded(2, 2, SIZE, 10, &image.bm);
+        assert(loaded.getInodeLocation(3) == 40);
+        assert(loaded.getInodeLocation(TABLE_ENTRIES_PER_BLOCK + 1) == 41);
+        assert(loaded.getInodeLocation(4) == INODE_NULL_VALUE);
+    }
+    assert(table.setInodeLocation(3, INODE_NULL_VALUE));
+    assert(table.flush());
+    InodeTable loaded(2, 2, SIZE, 10, &image.bm);
+    assert(loaded.getInodeLocation(3) == INODE_NULL_VALUE);
+    assert(loaded.getInodeLocation(TABLE_ENTRIES_PER_BLOCK + 1) == 41);
+}
+
+// getFreeInodeNumber hands out the lowest number without a location and keeps it reserved until its location is
+// set; setting a location to INODE_NULL_VALUE makes the number free again.
+static void testFreeInodeNumbers() {
+    TestDisk image("test_imap.img", 8192);
+    assert(InodeTable::initialize(2, 2, &image.bm));
+    constexpr inode_index_t SIZE = 2 * TABLE_ENTRIES_PER_BLOCK;
+
+    InodeTable table(2, 2, SIZE, 10, &image.bm);
+    assert(table.getFreeInodeNumber() == 0);
+    assert(table.getFreeInodeNumber() == 1);
+    assert(table.setInodeLocation(0, 100));
+    assert(table.setInodeLocation(1, INODE_NULL_VALUE));
+    assert(table.getFreeInodeNumber() == 1);
+    for (inode_index_t n = 1; n < 200; n++) {
+        assert(table.setInodeLocation(n, 100 + n));
+    }
+    assert(table.getFreeInodeNumber() == 200);
+    assert(table.setInodeLocation(70, INODE_NULL_VALUE));
+    assert(table.getFreeInodeNumber() == 70);
+    assert(table.getFreeInodeNumber() == 201);
+    for (inode_index_t n = 202; n < SIZE; n++) {
+        assert(table.setInodeLocation(n, n));
+    }
+    assert(table.getFreeInodeNumber() == INODE_NULL_VALUE);
+
+    // A table loaded from disk rebuilds which numbers are in use.
+    assert(table.flush());
+    InodeTable loaded(2, 2, SIZE, 10, &image.bm);
+    assert(loaded.getFreeInodeNumber() == 70);
+    assert(loaded.getFreeInodeNumber() == 200);
+    assert(loaded.getFreeInodeNumber() == 201);
+}
+
+// A cached inode is served without reading its slot for as long as the inode number still maps to that slot;
+// once the number moves, the lookup misses and reads the new slot.
+static void testInodeCache() {
+    TestDisk image("test_imap.img", 8192);
+    assert(InodeTable::initialize(2, 2, &image.bm));
+    zeroBlocks(image.bm, 10, 1);
+
+    InodeTable table(2, 2, 2 * TABLE_ENTRIES_PER_BLOCK, 10, &image.bm);
+    inode_t inode{};
+    inode.size = 111;
+    assert(table.writeInode(3, inode));
+    assert(table.setInodeLocation(7, 3));
+    inode_index_t location;
+    inode_t read{};
+    assert(table.readInodeByNumber(7, location, read));
+    assert(location == 3 && read.size == 111);
+
+    // Slots are never rewritten while mapped; doing it anyway shows that the lookup does not read the slot.
+    inode.size = 222;
+    assert(table.writeInode(3, inode));
+    assert(table.readInodeByNumber(7, location, read));
+    assert(read.size == 111);
+
+    inode.size = 333;
+    assert(table.writeInode(4, inode));
+    assert(table.setInodeLocation(7, 4));
+    assert(table.readInodeByNumber(7, location, read));
+    assert(location == 4 && read.size == 333);
+
+    // cacheInode records a version just written, so the first lookup after it needs no read either.
+    inode.size = 444;
+    assert(table.writeInode(5, inode));
+    assert(table.setInodeLocation(7, 5));
+    inode.size = 555;
+    table.cacheInode(7, 5, inode);
+    assert(table.readInodeByNumber(7, location, read));
+    assert(location == 5 && read.size == 555);
+    assert(table.setInodeLocation(7, INODE_NULL_VALUE));
+    assert(!table.readInodeByNumber(7, location, read));
+}
+
+// New inode versions fill a wholly free inode block one slot after another and reach the disk with one write of
+// the whole block. Without a wholly free block a single slot is allocated and written in place; with block groups
+// a goal in another group opens a block there.
+static void testOpenInodeBlock() {
+    TestDisk image("test_islots.img", 8192);
+    assert(InodeTable::initialize(2, 1, &image.bm));
+    zeroBlocks(image.bm, 1, 1);
+    zeroBlocks(image.bm, 10, 8);
+    constexpr inode_index_t SLOTS = 8 * INODES_PER_BLOCK;
+
+    BitmapManager slots(1, 1, SLOTS, &image.bm);
+    InodeTable table(2, 1, TABLE_ENTRIES_PER_BLOCK, 10, &image.bm, 0, &slots);
+    const inode_index_t first = table.allocateInodeSlot();
+    assert(first % INODES_PER_BLOCK == 0);
+    inode_t inode{};
+    for (inode_index_t i = 0; i < INODES_PER_BLOCK; i++) {
+        const inode_index_t slot = i == 0 ? first : table.allocateInodeSlot();
+        assert(slot == first + i);
+        inode.size = slot;
+        assert(table.writeInode(slot, inode));
+    }
+    block_t onDisk;
+    assert(image.bm.readBlock(table.getInodeBlock(first), onDisk.data));
+    assert(onDisk.inodeBlock.inodes[1].size == 0);
+    inode_t read{};
+    assert(table.readInode(first + 1, read) && read.size == first + 1);
+    assert(table.flushInodes());
+    assert(image.bm.readBlock(table.getInodeBlock(first), onDisk.data));
+    for (inode_index_t i = 0; i < INODES_PER_BLOCK; i++) {
+        assert(onDisk.inodeBlock.inodes[i].size == first + i);
+    }
+
+    // The next slot opens another block; use it up, then leave a single free slot outside it.
+    const inode_index_t second = table.allocateInodeSlot();
+    assert(second % INODES_PER_BLOCK == 0 && second != first);
+    for (inode_index_t i = 1; i < INODES_PER_BLOCK; i++) {
+        assert(table.allocateInodeSlot() == second + i);
+    }
+    const inode_index_t lone = (first == 5 * INODES_PER_BLOCK || second == 5 * INODES_PER_BLOCK ? 6 : 5) *
+        INODES_PER_BLOCK + 3;
+    for (inode_index_t slot = 0; slot < SLOTS; slot++) {
+        if (slot != lone) {
+            slots.tryAllocate(slot);
+        }
+    }
+    assert(table.allocateInodeSlot() == lone);
+    inode.size = 77;
+    assert(table.writeInode(lone, inode));
+    assert(image.bm.readBlock(table.getInodeBlock(lone), onDisk.data));
+    assert(onDisk.inodeBlock.inodes[3].size == 77);
+    assert(table.allocateInodeSlot() == INODE_NULL_VALUE);
+
+    // Two groups of two inode blocks each, 100 blocks apart.
+    zeroBlocks(image.bm, 101, 1);
+    zeroBlocks(image.bm, 110, 2);
+    BitmapManager groupSlots(1, 2, INODE_LOCATIONS_PER_GROUP + 2 * INODES_PER_BLOCK, &image.bm, 0, 100,
+                             2 * INODES_PER_BLOCK);
+    InodeTable grouped(2, 1, TABLE_ENTRIES_PER_BLOCK, 10, &image.bm, 100, &groupSlots);
+    const inode_index_t a = grouped.allocateInodeSlot(0);
+    assert(a < 2 * INODES_PER_BLOCK);
+    const inode_index_t b = grouped.allocateInodeSlot(INODE_LOCATIONS_PER_GROUP);
+    assert(b / INODE_LOCATIONS_PER_GROUP == 1 && b % INODES_PER_BLOCK == 0);
+    assert(grouped.getInodeBlock(b) == 110 + b % INODE_LOCATIONS_PER_GROUP / INODES_PER_BLOCK);
+    assert(grouped.allocateInodeSlot(INODE_LOCATIONS_PER_GROUP) == b + 1);
+    const inode_index_t c = grouped.allocateInodeSlot(0);
+    assert(c < 2 * INODES_PER_BLOCK && c % INODES_PER_BLOCK == 0 && c / INODES_PER_BLOCK != a / INODES_PER_BLOCK);
+    inode.size = 88;
+    assert(grouped.writeInode(c, inode));
+    // Back in group 1, b's block is no longer open, so the other one there is; c's block is written on the way.
+    const inode_index_t d = grouped.allocateInodeSlot(INODE_LOCATIONS_PER_GROUP);
+    assert(d / INODE_LOCATIONS_PER_GROUP == 1 && d % INODES_PER_BLOCK == 0 && d != b);
+    assert(image.bm.readBlock(grouped.getInodeBlock(c), onDisk.data));
+    assert(onDisk.inodeBlock.inodes[0].size == 88);
+}
+
+// A snapshot table reads only the head of the checkpoint chain when it is created, and later blocks as lookups
+// reach them, keeping a few of them cached.
+static void testSnapshotChainLookups() {
+    TestDisk image("test_chain.img", 8192);
+    assert(InodeTable::initialize(2, 4, &image.bm));
+    InodeTable live(2, 4, 4 * TABLE_ENTRIES_PER_BLOCK, 10, &image.bm);
+
+    // Six chain blocks at 100..105, mapping inode n to n + 1000, with inode 1100 missing.
+    constexpr block_index_t CHAIN = 6;
+    static block_t chain[CHAIN];
+    inode_index_t n = 0;
+    for (block_index_t b = 0; b < CHAIN; b++) {
+        checkpointBlock_t &cp = chain[b].checkpointBlock;
+        cp = {};
+        cp.magic = CHECKPOINT_MAGIC;
+        cp.isHeader = b == 0;
+        cp.nextCheckpointBlock = b + 1 < CHAIN ? 100 + b + 1 : NULL_INDEX;
+        for (cp.numEntries = 0; cp.numEntries < NUM_CHECKPOINTENTRIES_PER_CHECKPOINT; n++) {
+            if (n != 1100) {
+                cp.entries[cp.numEntries++] = {n, n + 1000};
+            }
+        }
+    }
+    const inode_index_t last = n - 1;
+    assert(image.bm.writeBlock(100, chain[0].data));
+    zeroBlocks(image.bm, 101, CHAIN - 1);
+
+    // Only the head is read up front, so the rest of the chain need not be there yet.
+    InodeTable *snapshot = InodeTable::createSnapshotFromCheckpoint(100, &live);
+    assert(snapshot != nullptr);
+    assert(snapshot->getInodeLocation(0) == 1000);
+    assert(snapshot->getInodeLocation(NUM_CHECKPOINTENTRIES_PER_CHECKPOINT - 1) ==
+           NUM_CHECKPOINTENTRIES_PER_CHECKPOINT - 1 + 1000);
+    for (block_index_t b = 1; b < CHAIN; b++) {
+        assert(image.bm.writeBlock(100 + b, chain[b].data));
+    }
+    assert(snapshot->getInodeLocation(last) == last + 1000);
+    assert(snapshot->getInodeLocation(1100) == INODE_NULL_VALUE);
+    assert(snapshot->getInodeLocation(1101) == 2101);
+    assert(snapshot->getInodeLocation(last + 1) == INODE_NULL_VALUE);
+    // More blocks were read than are cached, so these are read again.
+    for (inode_index_t i = 0; i <= last; i += 97) {
+        assert(snapshot->getInodeLocation(i) == (i == 1100 ? INODE_NULL_VALUE : i + 1000));
+    }
+    delete snapshot;
+
+    // A chain with a broken head is refused.
+    zeroBlocks(image.bm, 100, 1);
+    assert(InodeTable::createSnapshotFromCheckpoint(100, &live) == nullptr);
+}
+
+// Snapshot tables stay around once created, so several snapshots can be mounted in turn without rereading their
+// checkpoints, and each still sees its own version of a file.
+static void testSeveralSnapshots() {
+    TestFileSystem image("test_snaps.img", 8192);
+
+    const inode_index_t inode = fs_req_create_file(0, false, "file2", 0).inode_index;
+    assert(fs_req_write(inode, "first", 0, 6).status == FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    const uint32_t first = fileSystem->getSuperBlock()->latestCheckpointIndex;
+    assert(fs_req_write(inode, "other", 0, 6).status == FS_RESP_SUCCESS);
+    assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+    const uint32_t second = fileSystem->getSuperBlock()->latestCheckpointIndex;
+    assert(fs_req_write(inode, "live!", 0, 6).status == FS_RESP_SUCCESS);
+
+    assert(fs_req_mount_snapshot(first).status == FS_RESP_SUCCESS);
+    InodeTable *firstTable = fileSystem->inodeTable;
+    assert(readPath("/file2", 6) == "first");
+    assert(fs_req_mount_snapshot(second).status == FS_RESP_SUCCESS);
+    InodeTable *secondTable = fileSystem->inodeTable;
+    assert(secondTable != firstTable);
+    assert(readPath("/file2", 6) == "other");
+    assert(fs_req_mount_snapshot(first).status == FS_RESP_SUCCESS);
+    assert(fileSystem->inodeTable == firstTable);
+    assert(readPath("/file2", 6) == "first");
+    assert(fileSystem->getSnapshotTable(second) == secondTable);
+    assert(fs_req_mount_snapshot(0).status == FS_RESP_SUCCESS);
+    assert(readPath("/file2", 6) == "live!");
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
+// allocate() serves each thread from its own magazine of reserved bits. Reserved bits count as free and go to disk
+// as free, a flush leaves the magazine alone, a distant goal refills it near the goal, and checkpoints take back
+// what is left.
+static void testBitmapMagazines() {
+    TestDisk image("test_bitmap.img", 8192);
+    zeroBlocks(image.bm, 1, 2);
+    constexpr block_index_t BITS = BitmapManager::BITS_PER_BLOCK;
+
+    BitmapManager bitmap(1, 2, 2 * BITS, &image.bm);
+    const block_index_t a = bitmap.allocate(0);
+    assert(a == 0);
+    assert(bitmap.getFreeCount() == 2 * BITS - 1);
+    assert(bitmap.flush());
+    {
+        BitmapManager loaded(1, 2, 2 * BITS, &image.bm);
+        assert(loaded.getFreeCount() == 2 * BITS - 1);
+        assert(loaded.findNextFree(0) == 1);
+    }
+    // Still reserved for this thread after the flush, so another thread's allocation goes elsewhere.
+    block_index_t other = NULL_INDEX;
+    std::thread([&]() { other = bitmap.allocate(0); }).join();
+    assert(other != NULL_INDEX && other > a + 1);
+    assert(bitmap.allocate(0) == a + 1);
+    assert(!bitmap.tryAllocate(a + 2));
+
+    // A goal in another part of the bitmap is honored, and the rest of the old magazine is given back.
+    const block_index_t far = bitmap.allocate(BITS + 100);
+    assert(far == BITS + 100);
+    assert(bitmap.allocate(BITS + 100) == far + 1);
+    assert(bitmap.tryAllocate(a + 2));
+
+    const block_index_t free = bitmap.getFreeCount();
+    bitmap.releaseReservations();
+    assert(bitmap.getFreeCount() == free);
+    assert(bitmap.tryAllocate(far + 2));
+    assert(bitmap.tryAllocate(other + 1));
+    assert(bitmap.flush());
+    BitmapManager loaded(1, 2, 2 * BITS, &image.bm);
+    assert(loaded.getFreeCount() == bitmap.getFreeCount());
+}
+
+// Retired objects are reclaimed in batches as they are retired, even after a scan had to leave some behind, and
+// synchronize reclaims whatever is left.
+static void testEpochReclaim() {
+    EpochManager epochs;
+    uint64_t reclaimed = 0;
+    const auto count = [](void *context, uint64_t) { ++*static_cast<uint64_t *>(context); };
+    for (int i = 0; i < 3 * 64; i++) {
+        epochs.retire(count, &reclaimed);
+    }
+    assert(reclaimed >= 64);
+    epochs.retire(count, &reclaimed);
+    epochs.synchronize();
+    assert(reclaimed == 3 * 64 + 1);
+}
+
+// Slots freed by checkpoints and the last commit before an unmount reach the inode bitmap on disk, so remounting
+// over and over does not lose any.
+static void testInodeSlotsAcrossRemounts() {
+    TestFileSystem image("test_remount.img", 65536);
+    assert(fs_req_create_file(0, false, "file2", 0).status == FS_RESP_SUCCESS);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+    uint64_t freeInodes = 0;
+    for (int cycle = 0; cycle < 8; cycle++) {
+        init(&image.bm);
+        // From the second mount on every retained checkpoint holds a slot of its own.
+        if (cycle == 1) {
+            freeInodes = fs_req_statfs().free_inodes;
+        }
+        assert(cycle < 1 || fs_req_statfs().free_inodes == freeInodes);
+        const inode_index_t inode = fs_req_open("/file2").inode_index;
+        for (int i = 0; i < 150; i++) {
+            assert(fs_req_write(inode, "rewrite", 0, 8).status == FS_RESP_SUCCESS);
+            assert(fs_req_create_checkpoint().status == FS_RESP_SUCCESS);
+        }
+        assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+    }
+}
+
+// Members driven from a worker thread see the I/O context of the request, like the member the caller drives.
+static void testIoContextOnWorkers() {
+    FakeDiskDriver disk("test_ctx.img", 1024, std::chrono::milliseconds(0));
+    assert(disk.createPartition(0, 512, "ctx0"));
+    assert(disk.createPartition(512, 512, "ctx1"));
+    auto parts = disk.listPartitions();
+    BlockManager d0(disk, parts[0], 64);
+    BlockManager d1(disk, parts[1], 64);
+    PriorityBlockManager s0(&d0, std::chrono::hours(1));
+    PriorityBlockManager s1(&d1, std::chrono::hours(1));
+
+    static uint8_t out[8 * BlockManager::BLOCK_SIZE];
+    {
+        IoContextScope scope(IoPriority::IO_PRIORITY_BACKGROUND);
+        MirroredBlockManager mirrored(&s0, &s1);
+        assert(mirrored.writeBlock(0, out));
+        StripedBlockManager striped({&s0, &s1}, 4);
+        assert(striped.writeBlocks(0, 8, out));
+    }
+    for (PriorityBlockManager *sched : {&s0, &s1}) {
+        const auto stats = sched->getStats();
+        assert(stats.foregroundOps == 0 && stats.backgroundOps == 2);
+    }
+
+    QosBlockManager q0(&d0);
+    QosBlockManager q1(&d1);
+    {
+        IoContextScope scope(7);
+        MirroredBlockManager mirrored(&q0, &q1);
+        assert(mirrored.writeBlock(0, out));
+    }
+    assert(q0.getTenantStats(7).ops == 1 && q1.getTenantStats(7).ops == 1);
+    assert(q1.getTenantStats(0).ops == 0);
+}
+
+// The log can live in a range of another device. It wraps there like it does on the main device, and a clean
+// remount and one from a copy of both disks taken before the unmount both find everything.
+static void testExternalLog() {
+    TestDisk logImage("test_extlog_log.img", 1024);
+    FileSystemOptions options;
+    options.logBlockManager = &logImage.bm;
+    options.logBlockStart = 8;
+    options.logBlockCount = 3;
+    TestFileSystem image("test_extlog.img", 65536, options);
+
+    const superBlock_t *superBlock = fileSystem->getSuperBlock();
+    assert(superBlock->logDeviceBlocks == 128);
+    assert(superBlock->logAreaStart == 8 && superBlock->logAreaSize == 3);
+    const inode_index_t inode = fs_req_create_file(0, false, "file2", 0).inode_index;
+    const uint32_t initial = superBlock->latestCheckpointIndex;
+    char msg[32];
+    const int writes = 4 * options.logBlockCount * NUM_LOGRECORDS_PER_LOGENTRY;
+    for (int i = 0; i < writes; i++) {
+        std::snprintf(msg, sizeof(msg), "write %d", i);
+        assert(fs_req_write(inode, msg, 0, std::strlen(msg) + 1).status == FS_RESP_SUCCESS);
+    }
+    assert(superBlock->latestCheckpointIndex > initial);
+    assert(fs_req_log_stats().records > options.logBlockCount * NUM_LOGRECORDS_PER_LOGENTRY);
+
+    image.disk.flush();
+    logImage.disk.flush();
+    copyImage("test_extlog.img", "test_extlog_crash.img");
+    copyImage("test_extlog_log.img", "test_extlog_log_crash.img");
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+    checkFile2AfterMount(image.bm, msg, options);
+
+    TestDisk crash("test_extlog_crash.img", 65536);
+    TestDisk crashLog("test_extlog_log_crash.img", 1024);
+    options.logBlockManager = &crashLog.bm;
+    checkFile2AfterMount(crash.bm, msg, options);
+}
+
+// With a data device the metadata device only holds metadata and the log, with as many inodes as fit on it, and
+// file data goes above the fast tier. Everything is still there after a remount.
+static void testTieredFileSystem() {
+    TestDisk slow("test_tier_data.img", 65536);
+    FileSystemOptions options;
+    options.dataBlockManager = &slow.bm;
+    options.logBlockCount = 4;
+    TestFileSystem fast("test_tier_meta.img", 256, options);
+
+    const superBlock_t *superBlock = fileSystem->getSuperBlock();
+    assert(superBlock->metadataDeviceBlocks == 32 && superBlock->dataDeviceBlocks == 8192);
+    // One inode per four data blocks would not fit on 32 blocks.
+    assert(superBlock->inodeCount < 4 * (8192 / 16));
+    assert(superBlock->logAreaStart + superBlock->logAreaSize <= 32);
+    assert(fs_req_statfs().total_blocks == 8192);
+    const auto *tiered = dynamic_cast<TieredBlockManager *>(fileSystem->blockManager);
+    assert(tiered && tiered->getFastTierBlocks() == 32);
+
+    const inode_index_t inode = fs_req_create_file(0, false, "tiered", 0).inode_index;
+    static char data[6 * BlockManager::BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = static_cast<char>('a' + i / BlockManager::BLOCK_SIZE);
+    }
+    assert(fs_req_write(inode, data, 0, sizeof(data)).status == FS_RESP_SUCCESS);
+    inode_index_t location;
+    inode_t contents;
+    assert(fileSystem->inodeTable->readInodeByNumber(inode, location, contents));
+    assert(contents.blockCount == 6);
+    for (int i = 0; i < 6; i++) {
+        assert(contents.directBlocks[i] >= tiered->getFastTierBlocks());
+    }
+    block_t onDisk;
+    assert(slow.bm.readBlock(contents.directBlocks[5] - tiered->getFastTierBlocks(), onDisk.data));
+    assert(onDisk.data[0] == 'f');
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+    init(&fast.bm, options);
+    const auto ro = fs_req_open("/tiered");
+    assert(ro.status == FS_RESP_SUCCESS);
+    static char in[sizeof(data)];
+    assert(fs_req_read(ro.inode_index, in, 0, sizeof(in)).status == FS_RESP_SUCCESS);
+    assert(std::memcmp(in, data, sizeof(data)) == 0);
+    assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+}
+
 int main() {
     using namespace fs;
 
+    testStripedBlockManager();
+    testMirroredBlockManager();
+    testTieredBlockManager();
+    testQosBlockManager();
+    testPriorityBlockManager();
+
     // Setup
     FakeDiskDriver disk("test_fs.img", 8192);
     assert(disk.createPartition(0, 8192, "ext4"));
@@ -101,6 +1266,9 @@ int main() {
     //2.5 WRITE large amounts of data (20 KB)
     {
         cout << "Writing large file "<< endl;
+        auto before = fs_req_statfs();
+        assert(before.status == FS_RESP_SUCCESS);
+        assert(before.free_blocks < before.total_blocks && before.free_inodes < before.total_inodes);
         const int bufferSize = 20 * 4096;
         char msg[bufferSize];
         std::memset(msg, 'a', bufferSize);  // populate with 'a's
@@ -114,6 +1282,11 @@ int main() {
         auto rd = fs_req_read(file2inode, buffer, 0, bufferSize);
         assert(rd.status == FS_RESP_SUCCESS);
         assert(buffer[bufferSize - 2] == 'a');
+
+        // copy-on-write: the whole file went to 20 new blocks
+        auto after = fs_req_statfs();
+        assert(after.free_blocks <= before.free_blocks - 20);
+        assert(after.free_inodes < before.free_inodes);
     }
 
     // 3) DELETE file1
@@ -196,7 +1369,7 @@ int main() {
              assert(found == exists);
              if (exists) {
                  int expectedLen = std::strlen(expected) + 1;
-                 std::string content = readFile(file2inode, expectedLen);
+                 std::string content = readPath("/file2", expectedLen);
                  assert(content == expected);
              }
          };
@@ -284,6 +1457,56 @@ int main() {
         assert(std::strcmp(buffer, msg) == 0);
     }
 
+    // 6) Remount. Without an unmount the superblock still points at the last checkpoint and the mount has to find
+    // the rest of the log by scanning forward; after a clean unmount it points at the end of the log.
+    {
+        assert(fs_req_sync().status == FS_RESP_SUCCESS);
+        disk.flush();
+        copyImage("test_fs.img", "test_fs_crash.img");
+        assert(fs_req_unmount().status == FS_RESP_SUCCESS);
+
+        TestDisk crash("test_fs_crash.img", 8192);
+        block_t superBlock{};
+        assert(crash.bm.readBlock(0, superBlock.data));
+        const uint64_t crashSequence = superBlock.superBlock.systemStateSeqNum;
+        checkFile2AfterMount(crash.bm, "goodbye world");
+
+        assert(bm.readBlock(0, superBlock.data));
+        assert(superBlock.superBlock.systemStateSeqNum > crashSequence);
+        checkFile2AfterMount(bm, "goodbye world");
+        // A remount logs nothing, so it leaves the end of the log where it was.
+        const uint64_t cleanSequence = superBlock.superBlock.systemStateSeqNum;
+        assert(bm.readBlock(0, superBlock.data));
+        assert(superBlock.superBlock.systemStateSeqNum == cleanSequence);
+    }
+
+    testManyCheckpoints();
+    testPinnedSnapshotEviction();
+    testBackgroundCheckpointer();
+    testInodeSlotsReused();
+    testLogWrap();
+    testGroupCommit(0);
+    testGroupCommit(20);
+    testBitmapSummaries();
+    testBitmapWordScan();
+    testBitmapRanges();
+    testContiguousFileBlocks();
+    testBitmapGoal();
+    testBlockGroups();
+    testBitmapFlush();
+    testInodeMapFlush();
+    testFreeInodeNumbers();
+    testInodeCache();
+    testOpenInodeBlock();
+    testSnapshotChainLookups();
+    testSeveralSnapshots();
+    testBitmapMagazines();
+    testEpochReclaim();
+    testInodeSlotsAcrossRemounts();
+    testIoContextOnWorkers();
+    testExternalLog();
+    testTieredFileSystem();
+
     std::puts("All tests passed!");
     return 0;
 }